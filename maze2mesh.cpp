@@ -8,16 +8,79 @@
 #include <cstdlib>
 #include <cstring>
 #include <cerrno>
+#include <cstdint>
+#include <cstdarg>
+#include <cmath>
+#include <ctime>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
 #include <vector>
 #include <limits>
 #include <format>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <charconv>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <bit>
+#include <filesystem>
+
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "meshoptimizer.h"
 
 const float f_min = std::numeric_limits<float>::lowest();
 const float f_max = std::numeric_limits<float>::max();
 
+// Rows per band of parallel mesh generation. Greedy merging does not cross band boundaries.
+const int band_rows = 64;
+
+// Side of the square blocks of the blocked map layout, see Maze::index(). The first blocks
+// are shared by all blocks of only padding and of only spaces.
+const int block_size = 64;
+const size_t block_tiles = (size_t)block_size * block_size;
+enum SharedBlock : uint32_t {
+	BLOCK_ZERO,
+	BLOCK_SPACE,
+	shared_blocks
+};
+
+// Progress messages are printed unless --quiet, or when converting several maps at once.
+bool verbose = true;
+
+__attribute__((format(printf, 1, 2)))
+void info(const char *fmt, ...) {
+	if (verbose) {
+		va_list args;
+		va_start(args, fmt);
+		vprintf(fmt, args);
+		va_end(args);
+	}
+}
+
+// The message for an errno value. Unlike strerror(), safe on the threads of a batch run.
+std::string error_string(int err) {
+	char buf[256];
+#if defined(__GLIBC__) && defined(_GNU_SOURCE)
+	return strerror_r(err, buf, sizeof(buf));
+#else
+	return strerror_r(err, buf, sizeof(buf)) == 0 ? buf : std::format("Unknown error {}", err);
+#endif
+}
+
 struct Vertex {
 	float x,y,z;
 };
@@ -28,19 +91,52 @@ using BBox = Vertex[2];
 
 struct Mesh {
 	Mesh() : bbox({ f_max, f_max, f_max }, { f_min, f_min, f_min }) { }
+	void extend_bbox(const Vertex& v);
+	unsigned int add_vertex(const Vertex& v);
+	void add_quad(const unsigned int (&quad)[4]);
 	void optimize(void);
+	void optimize_post_transform(void);
+	void build_lods(int levels, float base_error, bool lock_border);
 
 	std::string name;
 	VertexArray vertices;
 	IndexBuffer indices;
 	BBox bbox;
+
+	// Simplified versions, from finest to coarsest.
+	std::vector<Mesh> lods;
 };
 
+void Mesh::extend_bbox(const Vertex& v) {
+	if (v.x < bbox[0].x) { bbox[0].x = v.x; }
+	if (v.y < bbox[0].y) { bbox[0].y = v.y; }
+	if (v.z < bbox[0].z) { bbox[0].z = v.z; }
+	if (v.x > bbox[1].x) { bbox[1].x = v.x; }
+	if (v.y > bbox[1].y) { bbox[1].y = v.y; }
+	if (v.z > bbox[1].z) { bbox[1].z = v.z; }
+}
+
+unsigned int Mesh::add_vertex(const Vertex& v) {
+	extend_bbox(v);
+	vertices.push_back(v);
+
+	return vertices.size() - 1;
+}
+
+// Quad corners in counter-clockwise order as seen from the front.
+void Mesh::add_quad(const unsigned int (&quad)[4]) {
+	for (int i : { 0, 1, 2, 0, 2, 3 }) {
+		indices.push_back(quad[i]);
+	}
+}
+
 void Mesh::optimize(void) {
 	size_t index_count = indices.size();
 	size_t vertex_count = vertices.size();
 
-	printf("Optimizing %s: %zu vertices -> ", name.c_str(), vertex_count);
+	if (vertex_count == 0) {
+		return;
+	}
 
 	IndexBuffer remap(vertex_count);
 
@@ -55,20 +151,341 @@ void Mesh::optimize(void) {
 	vertices = std::move(opt_vertices);
 	indices = std::move(opt_indices);
 
-	printf("%zu vertices.\n", opt_vertex_count);
+	// One call for the whole line, so it stays whole when chunks are optimized in parallel.
+	info("Optimizing %s: %zu vertices -> %zu vertices.\n", name.c_str(), vertex_count, opt_vertex_count);
+}
+
+// Reorder for the GPU: triangles for the post-transform vertex cache, then for less overdraw
+// without giving up much of that, then vertices in order of first use for fetch locality.
+void Mesh::optimize_post_transform(void) {
+	size_t index_count = indices.size();
+	size_t vertex_count = vertices.size();
+
+	if (index_count == 0) {
+		return;
+	}
+
+	const unsigned int cache_size = 16;
+	meshopt_VertexCacheStatistics before = meshopt_analyzeVertexCache(&indices[0], index_count, vertex_count, cache_size, 0, 0);
+
+	meshopt_optimizeVertexCache(&indices[0], &indices[0], index_count, vertex_count);
+	meshopt_optimizeOverdraw(&indices[0], &indices[0], index_count, &vertices[0].x, vertex_count, sizeof(Vertex), 1.05f);
+
+	VertexArray opt_vertices(vertex_count);
+	size_t opt_vertex_count = meshopt_optimizeVertexFetch(&opt_vertices[0], &indices[0], index_count, &vertices[0], vertex_count, sizeof(Vertex));
+	opt_vertices.resize(opt_vertex_count);
+	vertices = std::move(opt_vertices);
+
+	meshopt_VertexCacheStatistics after = meshopt_analyzeVertexCache(&indices[0], index_count, vertices.size(), cache_size, 0, 0);
+
+	info("Post-transform %s: ACMR %f -> %f, ATVR %f -> %f\n", name.c_str(), before.acmr, after.acmr, before.atvr, after.atvr);
+}
+
+// Simplify into up to 'levels' coarser meshes, each aiming for half the triangles of the one
+// before it, within a relative error bound that doubles per level from base_error. Stops early
+// once the simplifier can no longer reduce the mesh. With lock_border, vertices on open edges stay
+// put, so that the LODs of neighbouring chunks, whose shared faces culling removed, still meet.
+void Mesh::build_lods(int levels, float base_error, bool lock_border) {
+	unsigned int options = lock_border ? meshopt_SimplifyLockBorder : 0;
+	IndexBuffer src = indices;
+	float target_error = base_error;
+
+	for (int level = 1 ; level <= levels && !src.empty() ; ++level, target_error *= 2) {
+		size_t target_index_count = (indices.size() >> level) / 3 * 3;
+
+		IndexBuffer lod_indices(src.size());
+		float result_error = 0;
+		size_t index_count = meshopt_simplify(&lod_indices[0], &src[0], src.size(), &vertices[0].x, vertices.size(), sizeof(Vertex),
+			target_index_count, target_error, options, &result_error);
+		if (index_count == 0 || index_count >= src.size()) {
+			break;
+		}
+		lod_indices.resize(index_count);
+		src = lod_indices;
+
+		Mesh lod;
+		lod.name = std::format("{}_lod{}", name, level);
+		lod.indices = std::move(lod_indices);
+		lod.vertices.resize(vertices.size());
+		size_t vertex_count = meshopt_optimizeVertexFetch(&lod.vertices[0], &lod.indices[0], index_count, &vertices[0], vertices.size(), sizeof(Vertex));
+		lod.vertices.resize(vertex_count);
+		for (const Vertex& v : lod.vertices) {
+			lod.extend_bbox(v);
+		}
+
+		info("LOD %s: %zu triangles, error %f\n", lod.name.c_str(), index_count / 3, result_error);
+		lods.push_back(std::move(lod));
+	}
+}
+
+enum TileClass {
+	TILE_EMPTY,
+	TILE_WALL,
+	TILE_HOUSE,
+	TILE_UNKNOWN,
+};
+
+const int tile_class_count = TILE_UNKNOWN + 1;
+
+enum Face {
+	FACE_TOP,
+	FACE_BOTTOM,
+	FACE_POS_X,
+	FACE_NEG_X,
+	FACE_POS_Z,
+	FACE_NEG_Z,
+};
+
+// The TileClass of every tile byte. By default '*' is a wall, ' ' is empty, 'A' to 'Z' are
+// houses, and anything else is unknown.
+struct TileClassTable {
+	TileClassTable();
+	bool set(TileClass tc, const char *chars);
+
+	unsigned char cls[256];
+};
+
+TileClassTable::TileClassTable() {
+	memset(cls, TILE_UNKNOWN, sizeof(cls));
+	set(TILE_WALL, "*");
+	set(TILE_EMPTY, " ");
+	set(TILE_HOUSE, "A-Z");
+}
+
+// Assign 'tc' to every byte in 'chars', where "a-z" stands for a range. A '-' that does not sit
+// between two bytes stands for itself.
+bool TileClassTable::set(TileClass tc, const char *chars) {
+	const unsigned char *p = (const unsigned char*)chars;
+	while (*p) {
+		unsigned char first = *p;
+		unsigned char last = first;
+		if (p[1] == '-' && p[2]) {
+			last = p[2];
+			p += 3;
+		} else {
+			p += 1;
+		}
+		if (last < first) {
+			return false;
+		}
+		for (int c = first ; c <= last ; ++c) {
+			cls[c] = tc;
+		}
+	}
+	return true;
+}
+
+// One bit per tile, set for the tiles of one class, with each row padded to whole 64-bit words.
+// Bit x % 64 of word x / 64 of a row is tile x, and the padding bits are clear, but for the
+// TILE_UNKNOWN plane of a blocked map. This lets the mesher test 64 tiles, or their neighbours,
+// with a shift and a mask.
+//
+// When blocked, the words of each 64x64 block are stored together, one per row, so that the
+// rows above and below a tile are in the same 512 bytes, and blocks are shared like the map's.
+// Whether each 64x64 block has any bit set is kept in both layouts, so that the mesher can skip
+// the empty parts of the map.
+struct TileBits {
+	void resize(int width, int height, const std::vector<uint32_t>& map_blocks, size_t slots);
+	size_t offset(size_t i, int y) const;
+	bool test(int x, int y) const;
+	void set(int x, int y, bool on);
+	uint64_t window(int x, int y) const;
+	bool any(int rx0, int ry0, int rx1, int ry1) const;
+
+	int w = 0;
+	int h = 0;
+	size_t stride = 0;		// Words per row, and blocks per block row.
+	std::vector<uint32_t> blocks;	// When blocked, the slot of each block, as in Maze.
+	std::vector<uint64_t> words;
+	std::vector<unsigned char> occupied;	// Any bit set, per block.
+};
+
+void TileBits::resize(int width, int height, const std::vector<uint32_t>& map_blocks, size_t slots) {
+	w = width;
+	h = height;
+	stride = ((size_t)w + 63) / 64;
+	blocks = map_blocks;
+	words.assign(blocks.empty() ? stride * h : slots * block_size, 0);
+	occupied.assign(stride * (((size_t)h + block_size - 1) / block_size), 0);
+}
+
+// Index of word i, holding tiles 64 * i to 64 * i + 63, of row y.
+size_t TileBits::offset(size_t i, int y) const {
+	if (!blocks.empty()) {
+		return (size_t)blocks[(size_t)y / block_size * stride + i] * block_size + y % block_size;
+	}
+	return (size_t)y * stride + i;
+}
+
+bool TileBits::test(int x, int y) const {
+	if (x < 0 || y < 0 || x >= w || y >= h) {
+		return false;
+	}
+	return (words[offset(x / 64, y)] >> (x % 64)) & 1;
+}
+
+// Blocks stay marked as occupied when their last bit is cleared.
+void TileBits::set(int x, int y, bool on) {
+	uint64_t& word = words[offset(x / 64, y)];
+	uint64_t bit = (uint64_t)1 << (x % 64);
+	if (on) {
+		word |= bit;
+		occupied[y / block_size * stride + x / block_size] = 1;
+	} else {
+		word &= ~bit;
+	}
+}
+
+// Tiles x to x + 63 of row y in bits 0 to 63, clear outside the map.
+uint64_t TileBits::window(int x, int y) const {
+	if (y < 0 || y >= h) {
+		return 0;
+	}
+	auto word = [&](long i) -> uint64_t {
+		return i >= 0 && (size_t)i < stride ? words[offset(i, y)] : 0;
+	};
+
+	long i = x >> 6;
+	int shift = x & 63;
+	uint64_t res = word(i) >> shift;
+	if (shift) {
+		res |= word(i + 1) << (64 - shift);
+	}
+	return res;
+}
+
+// Whether any tile in [rx0,rx1) x [ry0,ry1) may be set, at the granularity of blocks.
+bool TileBits::any(int rx0, int ry0, int rx1, int ry1) const {
+	rx0 = std::max(rx0, 0);
+	ry0 = std::max(ry0, 0);
+	rx1 = std::min(rx1, w);
+	ry1 = std::min(ry1, h);
+	for (int by = ry0 / block_size ; by * block_size < ry1 ; ++by) {
+		for (int bx = rx0 / block_size ; bx * block_size < rx1 ; ++bx) {
+			if (occupied[by * stride + bx]) {
+				return true;
+			}
+		}
+	}
+	return false;
 }
 
+struct MeshOptions {
+	int threads = 1;
+	bool greedy = false;
+	bool cull = false;
+	bool top = true;
+	bool bottom = true;
+};
+
 struct Maze {
 	int w;
 	int h;
 	std::vector<unsigned char> data;
+	TileBits planes[tile_class_count];	// The tiles of each class.
+	TileBits solid;				// Walls and houses.
+	std::vector<uint32_t> blocks;		// When blocked, the slot of each block, see index().
+
+	bool blocked(void) const { return !blocks.empty(); }
+	size_t index(int x, int y) const;
+	unsigned char tile(int x, int y) const { return data[index(x, y)]; }
+	TileClass tile_class(int x, int y) const;
+	bool set_blocked(int threads);
+	void own_block(int x, int y);
 
 	Mesh	maze;
 	Mesh    houses;
 	Mesh	floor;
 	Mesh	ceiling;
+
+	// When meshing in chunks, these replace the maze and houses meshes.
+	std::vector<Mesh> chunks;
+
+	std::vector<const Mesh*> meshes(void) const;
+	std::vector<Mesh*> meshes(void);
 };
 
+// Index of tile (x, y) in data. Maps are loaded one row after another, unless blocked. The blocked
+// layout pads the map to whole block_size x block_size blocks, each stored one row after another in
+// the slot that 'blocks' gives for it, left to right and top to bottom. Only blocks with content
+// get a slot of their own; the others share one of the SharedBlock slots, so memory grows with the
+// content rather than the area of the map. Tiles x to the end of their block's row are contiguous
+// in both layouts.
+size_t Maze::index(int x, int y) const {
+	if (blocked()) {
+		size_t blocks_x = ((size_t)w + block_size - 1) / block_size;
+		size_t slot = blocks[(size_t)y / block_size * blocks_x + x / block_size];
+		return (slot * block_size + y % block_size) * block_size + x % block_size;
+	}
+	return (size_t)y * w + x;
+}
+
+// The class of a tile, from the bitplanes. This is for the odd lookup; the mesher reads the planes.
+TileClass Maze::tile_class(int x, int y) const {
+	for (int c = 0 ; c < tile_class_count ; ++c) {
+		if (planes[c].test(x, y)) {
+			return (TileClass)c;
+		}
+	}
+	return TILE_UNKNOWN;
+}
+
+// Give the block of tile (x, y) a slot of its own, in the map and its bitplanes, if it shares
+// one, so that its tiles can be changed.
+void Maze::own_block(int x, int y) {
+	if (!blocked()) {
+		return;
+	}
+	size_t blocks_x = ((size_t)w + block_size - 1) / block_size;
+	size_t b = (size_t)y / block_size * blocks_x + x / block_size;
+	size_t shared = blocks[b];
+	if (shared >= shared_blocks) {
+		return;
+	}
+	size_t slot = data.size() / block_tiles;
+	data.resize((slot + 1) * block_tiles);
+	memcpy(&data[slot * block_tiles], &data[shared * block_tiles], block_tiles);
+	auto own = [&](TileBits& plane) {
+		plane.words.resize((slot + 1) * block_size);
+		std::copy_n(&plane.words[shared * block_size], block_size, &plane.words[slot * block_size]);
+		plane.blocks[b] = slot;
+	};
+	for (TileBits& plane : planes) {
+		own(plane);
+	}
+	own(solid);
+	blocks[b] = slot;
+}
+
+// The meshes to export, in output order, skipping empty ones. LODs follow their mesh.
+std::vector<const Mesh*> Maze::meshes(void) const {
+	std::vector<const Mesh*> res;
+	auto add = [&](const Mesh& mesh) {
+		if (!mesh.vertices.empty()) {
+			res.push_back(&mesh);
+			for (const Mesh& lod : mesh.lods) {
+				res.push_back(&lod);
+			}
+		}
+	};
+
+	for (const Mesh& chunk : chunks) {
+		add(chunk);
+	}
+	for (const Mesh *mesh : { &maze, &houses, &floor, &ceiling }) {
+		add(*mesh);
+	}
+	return res;
+}
+
+std::vector<Mesh*> Maze::meshes(void) {
+	std::vector<Mesh*> res;
+	for (const Mesh *mesh : std::as_const(*this).meshes()) {
+		res.push_back(const_cast<Mesh*>(mesh));
+	}
+	return res;
+}
+
 template<>
 struct std::formatter<Vertex> {
 	constexpr auto parse(std::format_parse_context& ctx) {
@@ -92,258 +509,3171 @@ struct std::formatter<BBox> {
 };
 
 
-bool load_maze(const char *filename, Maze& map) {
+// Work-stealing thread pool. Each worker takes tasks from the back of its own queue and steals
+// from the front of the others' when it runs dry. Threads outside the pool submit to a shared
+// queue at the end.
+struct ThreadPool {
+	explicit ThreadPool(int worker_count);
+	~ThreadPool();
 
-	FILE *f = fopen(filename, "rb");
-	if (!f) {
-		return false;
-	}
+	void submit(std::function<void()> task);
+	bool run_one(void);
+	void wait(std::atomic<size_t>& remaining);
+	void finish(std::atomic<size_t>& remaining);
+	void work(size_t index);
 
-	char *line = NULL;
-	size_t line_size = 0;
-	ssize_t nread;
+	struct Queue {
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	};
 
-	int max_w = 0;
-	int max_h = 0;
+	std::vector<Queue> queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> pending;
+	std::mutex sleep_lock;
+	std::condition_variable wake;
+	bool stop = false;
+};
 
-	// First, just figure out the dimensions.
-	while ((nread = getline(&line, &line_size, f)) != -1) {
-		if (!line || !*line || *line == ';') {
-			continue;
-		}
+thread_local ThreadPool *current_pool = nullptr;
+thread_local size_t current_queue = 0;
 
-		int len = (int)strlen(line) - 1;
-		if (len > max_w) {
-			max_w = len;
-		}
-		++max_h;
+ThreadPool::ThreadPool(int worker_count) : queues(std::max(worker_count, 0) + 1), pending(0) {
+	for (int i = 0 ; i < worker_count ; ++i) {
+		workers.emplace_back(&ThreadPool::work, this, i);
 	}
+}
 
-	rewind(f);
+// Queued tasks are run before the workers exit.
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> guard(sleep_lock);
+		stop = true;
+	}
+	wake.notify_all();
+	for (std::thread& t : workers) {
+		t.join();
+	}
+}
 
-	map.w = max_w;
-	map.h = max_h;
-	map.data.assign(max_w * max_h, 0);
+void ThreadPool::submit(std::function<void()> task) {
+	Queue& q = queues[current_pool == this ? current_queue : queues.size() - 1];
+	{
+		std::lock_guard<std::mutex> guard(q.lock);
+		q.tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> guard(sleep_lock);
+		++pending;
+	}
+	wake.notify_one();
+}
 
-	int idx = 0;
-	while ((nread = getline(&line, &line_size, f)) != -1) {
-		if (!line || !*line || *line == ';') {
+// Run one task from the calling thread's own queue, or one stolen from another. Returns false if
+// there was none.
+bool ThreadPool::run_one(void) {
+	size_t n = queues.size();
+	size_t self = current_pool == this ? current_queue : n - 1;
+	std::function<void()> task;
+
+	for (size_t i = 0 ; i < n && !task ; ++i) {
+		Queue& q = queues[(self + i) % n];
+		std::lock_guard<std::mutex> guard(q.lock);
+		if (q.tasks.empty()) {
 			continue;
 		}
-
-		size_t len = strlen(line) - 1;
-
-		assert((int)len <= max_w);
-		assert((int)len + idx <= (int)map.data.size());
-
-		memcpy(&map.data[idx], line, len);
-
-		idx += map.w;
+		if (i == 0) {
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+		} else {
+			task = std::move(q.tasks.front());
+			q.tasks.pop_front();
+		}
 	}
-	free(line);
-	fclose(f);
 
+	if (!task) {
+		return false;
+	}
+	--pending;
+	task();
 	return true;
 }
 
-void write_mesh(FILE *f, const Mesh& mesh, int& total_vertex_count) {
-	if (mesh.vertices.size() == 0) {
-		return;
+// Help run tasks on the calling thread until 'remaining' drops to zero, sleeping only while there
+// are none queued, like a worker. Tasks must count themselves off with finish().
+void ThreadPool::wait(std::atomic<size_t>& remaining) {
+	while (remaining > 0) {
+		if (run_one()) {
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(sleep_lock);
+		wake.wait(guard, [&] { return remaining == 0 || pending > 0; });
 	}
+}
 
-	fprintf(f, "o %s\n", mesh.name.c_str());
+void ThreadPool::finish(std::atomic<size_t>& remaining) {
+	{
+		std::lock_guard<std::mutex> guard(sleep_lock);
+		--remaining;
+	}
+	wake.notify_all();
+}
 
-	for (const Vertex& v : mesh.vertices) {
-		fprintf(f, "v %f %f %f\n", v.x, v.y, v.z);
+void ThreadPool::work(size_t index) {
+	current_pool = this;
+	current_queue = index;
+	for (;;) {
+		if (run_one()) {
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(sleep_lock);
+		wake.wait(guard, [&] { return stop || pending > 0; });
+		if (stop && pending == 0) {
+			return;
+		}
 	}
+}
 
-	fprintf(f, "s 0\n");
+ThreadPool *thread_pool = nullptr;
 
-	for (size_t i = 0 ; i < mesh.indices.size() ; i += 3) {
-		fprintf(f, "f %d %d %d\n", 1 + total_vertex_count + mesh.indices[i + 0], 1 + total_vertex_count + mesh.indices[i + 1], 1 + total_vertex_count + mesh.indices[i + 2]);
+// Run fn(i) for every i in [0,n) on up to 'threads' threads, including the calling one. The others
+// are borrowed from thread_pool, and without one the caller does all the work. Helpers that
+// start after every index has been claimed return at once, so a busy pool never holds up the
+// caller.
+template<typename Fn>
+void parallel_for(size_t n, int threads, Fn&& fn) {
+	if (n == 0) {
+		return;
 	}
 
-	total_vertex_count += mesh.vertices.size();
-}
+	struct State {
+		std::atomic<size_t> next{0};
+		std::atomic<size_t> done{0};
+	};
+	auto state = std::make_shared<State>();
+	auto worker = [state, n, &fn]() {
+		size_t count = 0;
+		for (size_t i ; (i = state->next++) < n ; ++count) {
+			fn(i);
+		}
+		if (count > 0 && (state->done += count) == n) {
+			state->done.notify_all();
+		}
+	};
 
-bool write_map_obj(const char *filename, Maze& map) {
+	size_t helpers = thread_pool ? std::min((size_t)std::max(threads, 1), n) - 1 : 0;
+	for (size_t t = 0 ; t < helpers ; ++t) {
+		thread_pool->submit(worker);
+	}
+	worker();
+	for (size_t d ; (d = state->done) < n ; ) {
+		state->done.wait(d);
+	}
+}
 
-	FILE *fout = fopen(filename, "w");
-	if (!fout) {
+// Lay out a map of w x h tiles in blocks, where row(y) gives the tiles of row y and their count,
+// the rest of the row being zero padding. Each band of blocks is checked for blocks of only
+// zeros or only spaces in parallel, then the other blocks get slots in map order and are copied.
+template <typename Fn>
+bool store_blocks(Maze& map, int threads, Fn&& row) {
+	size_t blocks_x = ((size_t)map.w + block_size - 1) / block_size;
+	size_t blocks_y = ((size_t)map.h + block_size - 1) / block_size;
+	if (blocks_x * blocks_y >= std::numeric_limits<uint32_t>::max()) {
+		errno = EFBIG;
 		return false;
 	}
+	std::vector<uint32_t> blocks(blocks_x * blocks_y);
+
+	auto all = [](const unsigned char *p, size_t n, unsigned char c) {
+		return std::all_of(p, p + n, [c](unsigned char t) { return t == c; });
+	};
 
-	fprintf(fout, "# maze2mesh -- https://github.com/eloj/maze2mesh\n");
+	parallel_for(blocks_y, threads, [&](size_t by) {
+		int y0 = by * block_size;
+		int y1 = std::min(y0 + block_size, map.h);
+		for (size_t bx = 0 ; bx < blocks_x ; ++bx) {
+			size_t x0 = bx * block_size;
+			bool zero = true;
+			bool space = y1 - y0 == block_size;
+			for (int y = y0 ; y < y1 && (zero || space) ; ++y) {
+				auto [tiles, len] = row(y);
+				size_t n = len > x0 ? std::min(len - x0, (size_t)block_size) : 0;
+				zero = zero && all(tiles + x0, n, 0);
+				space = space && n == block_size && all(tiles + x0, n, ' ');
+			}
+			blocks[by * blocks_x + bx] = zero ? BLOCK_ZERO : space ? BLOCK_SPACE : shared_blocks;
+		}
+	});
 
-	int total_vertex_count = 0;
-	write_mesh(fout, map.maze, total_vertex_count);
-	write_mesh(fout, map.houses, total_vertex_count);
-	write_mesh(fout, map.floor, total_vertex_count);
-	write_mesh(fout, map.ceiling, total_vertex_count);
-	fclose(fout);
+	size_t slots = shared_blocks;
+	for (uint32_t& slot : blocks) {
+		if (slot == shared_blocks) {
+			slot = slots++;
+		}
+	}
 
-	printf("Final vertex count: %d\n", total_vertex_count);
+	std::vector<unsigned char> data(slots * block_tiles, 0);
+	memset(&data[BLOCK_SPACE * block_tiles], ' ', block_tiles);
+	parallel_for(blocks_y, threads, [&](size_t by) {
+		int y0 = by * block_size;
+		int y1 = std::min(y0 + block_size, map.h);
+		for (size_t bx = 0 ; bx < blocks_x ; ++bx) {
+			size_t slot = blocks[by * blocks_x + bx];
+			if (slot < shared_blocks) {
+				continue;
+			}
+			size_t x0 = bx * block_size;
+			for (int y = y0 ; y < y1 ; ++y) {
+				auto [tiles, len] = row(y);
+				if (len > x0) {
+					memcpy(&data[(slot * block_size + y - y0) * block_size], tiles + x0, std::min(len - x0, (size_t)block_size));
+				}
+			}
+		}
+	});
 
+	map.data.swap(data);
+	map.blocks.swap(blocks);
 	return true;
 }
 
-void add_bbox_plane(Mesh &mesh, const BBox& bbox, float ypos) {
-	const int scale = 1;
-	int base_vrt = mesh.vertices.size();
-
-	Vertex rectverts[] = {
-		{ bbox[1].x, ypos, bbox[1].z },
-		{ bbox[1].x, ypos, bbox[0].z },
-		{ bbox[0].x, ypos, bbox[0].z },
-		{ bbox[0].x, ypos, bbox[1].z }
-	};
+// Switch a map loaded or generated one row after another to the blocked layout, before it is
+// classified.
+bool Maze::set_blocked(int threads) {
+	if (blocked()) {
+		return true;
+	}
+	std::vector<unsigned char> rows;
+	rows.swap(data);
+	return store_blocks(*this, threads, [&](int y) {
+		return std::pair<const unsigned char*, size_t>(&rows[(size_t)y * w], w);
+	});
+}
 
-	int rectidx[] = { 0, 1, 3, 1, 2, 3 };
+// Load a map one row after another, or straight into the blocked layout, which never allocates
+// the blocks of only spaces or padding.
+bool load_maze(const char *filename, Maze& map, bool blocked, int threads) {
 
-	for (Vertex& v : rectverts) {
-		v.x *= scale;
-		v.y *= scale;
-		v.z *= scale;
-		mesh.vertices.push_back(v);
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return false;
 	}
 
-	for (int i : rectidx) {
-		mesh.indices.push_back(base_vrt + i);
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return false;
 	}
-}
-
-void add_box_at(Maze& map, int x, int y, Mesh& mesh) {
-	const int scale = 1;
-	int base_vrt = mesh.vertices.size();
 
-	Vertex boxverts[] = {
-		{ 1.0, 1.0, -1.0 },
-		{ 1.0, 0.0, -1.0 },
-		{ 1.0, 1.0,  0.0 },
-		{ 1.0, 0.0,  0.0 },
-		{ 0.0, 1.0, -1.0 },
-		{ 0.0, 0.0, -1.0 },
-		{ 0.0, 1.0,  0.0 },
-		{ 0.0, 0.0,  0.0 }
-	};
+	size_t size = st.st_size;
+	void *mem = NULL;
+	if (size > 0) {
+		mem = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mem == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		madvise(mem, size, MADV_SEQUENTIAL);
+	}
+	close(fd);
 
-	int boxind[] = {
-		4, 2, 0, 2, 7, 3,
-		6, 5, 7, 1, 7, 5,
-		0, 3, 1, 4, 1, 5,
-		4, 6, 2, 2, 6, 7,
-		6, 4, 5, 1, 3, 7,
-		0, 2, 3, 4, 0, 1
+	struct Row {
+		const char *start;
+		size_t len;
 	};
+	std::vector<Row> rows;
+
+	size_t max_w = 0;
+
+	// Single pass over the mapping to find the row boundaries, skipping comments.
+	const char *p = (const char*)mem;
+	const char *end = p + size;
+	while (p < end) {
+		const char *eol = (const char*)memchr(p, '\n', end - p);
+		const char *next = eol ? eol + 1 : end;
+		if (!eol) {
+			eol = end;
+		}
 
-	for (Vertex& v : boxverts) {
-		v.x *= scale;
-		v.y *= scale;
-		v.z *= scale;
-
-		v.x += (x - map.w/2) * scale;
-		v.z += (y - map.h/2) * scale;
-
-		if (v.x < mesh.bbox[0].x) { mesh.bbox[0].x = v.x; }
-		if (v.y < mesh.bbox[0].y) { mesh.bbox[0].y = v.y; }
-		if (v.z < mesh.bbox[0].z) { mesh.bbox[0].z = v.z; }
-		if (v.x > mesh.bbox[1].x) { mesh.bbox[1].x = v.x; }
-		if (v.y > mesh.bbox[1].y) { mesh.bbox[1].y = v.y; }
-		if (v.z > mesh.bbox[1].z) { mesh.bbox[1].z = v.z; }
+		if (*p != ';') {
+			size_t len = eol - p;
+			if (len > max_w) {
+				max_w = len;
+			}
+			rows.push_back({ p, len });
+		}
+		p = next;
+	}
 
-		mesh.vertices.push_back(v);
+	bool ok = true;
+	if (max_w > (size_t)std::numeric_limits<int>::max() || rows.size() > (size_t)std::numeric_limits<int>::max()) {
+		errno = EFBIG;
+		ok = false;
+	} else if (blocked) {
+		map.w = max_w;
+		map.h = rows.size();
+		ok = store_blocks(map, threads, [&](int y) {
+			return std::pair<const unsigned char*, size_t>((const unsigned char*)rows[y].start, rows[y].len);
+		});
+	} else {
+		map.w = max_w;
+		map.h = rows.size();
+		map.data.assign(max_w * rows.size(), 0);
+
+		size_t idx = 0;
+		for (const Row& row : rows) {
+			if (row.len > 0) {
+				memcpy(&map.data[idx], row.start, row.len);
+			}
+			idx += map.w;
+		}
 	}
 
-	for (int i : boxind) {
-		mesh.indices.push_back(base_vrt + i);
+	if (mem) {
+		munmap(mem, size);
 	}
+
+	return ok;
 }
 
-int main(int argc, char *argv[]) {
-	const char *filename = argc > 1 ? argv[1] : "data/bt1skarabrae.txt";
-	bool do_write_tilemap = true;
-	bool do_zero_unknown_tiles = false;
-	bool do_meshopt = true;
-	bool do_floor = true;
-	bool do_ceil = false;
+// Synthetic maps for benchmarking, from a spec of KIND:WxH or KIND:WxH:SEED, up to
+// max_generated_size tiles on a side:
+//
+//   maze  a perfect maze carved with the sidewinder algorithm, one-tile walls and passages
+//   cave  random fill smoothed by a cellular automaton
+//   city  a grid of streets around blocks of houses, walled yards and open squares
+//
+// Each row draws from its own generator seeded by the row index, so rows are built in parallel
+// and the map does not depend on the thread count.
+const int max_generated_size = 65536;
+
+uint64_t mix64(uint64_t x) {
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
 
-	Maze map;
-	if (!load_maze(filename, map)) {
-		fprintf(stderr, "Error loading map '%s': %s\n", filename, strerror(errno));
-		return EXIT_FAILURE;
+// SplitMix64.
+struct Random {
+	explicit Random(uint64_t seed, uint64_t stream) : state(mix64(seed ^ mix64(stream + 1))) { }
+	uint64_t next(void) {
+		return mix64(state += 0x9e3779b97f4a7c15ULL);
+	}
+	uint32_t below(uint32_t n) {
+		return (uint32_t)(((next() >> 32) * n) >> 32);
 	}
 
-	printf("Loaded %dx%d map '%s'\n", map.w, map.h, filename);
+	uint64_t state;
+};
 
-	map.maze.name = "maze";
-	map.houses.name = "houses";
-	for (int j = 0 ; j < map.h ; ++j) {
-		for (int i = 0 ; i < map.w ; ++i) {
-			int idx = j * map.h + i;
-			switch (map.data[idx]) {
-				case '*':
-					add_box_at(map, i, j, map.maze);
-					printf("#");
-					break;
-				case ' ':
-					printf(" ");
-					break;
-				default:
-					if ((map.data[idx] >= 'A') && (map.data[idx] <= 'Z')) {
-						add_box_at(map, i, j, map.houses);
-						printf("%c", map.data[idx]);
-					} else if (do_zero_unknown_tiles) {
-						map.data[idx] = 0;
-						printf("?");
-					} else {
-						printf("%c", map.data[idx]);
-					}
+void generate_perfect_maze(Maze& map, uint64_t seed, int threads) {
+	// Cells sit on odd coordinates, with walls between them. Cell row cy only carves tile rows
+	// 2cy + 1 and, for its passages north, 2cy.
+	int cw = (map.w - 1) / 2;
+	int ch = (map.h - 1) / 2;
+	map.data.assign((size_t)map.w * map.h, '*');
+
+	parallel_for(ch, threads, [&](size_t cy) {
+		Random rnd(seed, cy);
+		unsigned char *row = &map.data[(2 * cy + 1) * map.w];
+		unsigned char *north = &map.data[2 * cy * map.w];
+		int run_start = 0;
+		for (int cx = 0 ; cx < cw ; ++cx) {
+			row[2 * cx + 1] = ' ';
+			bool last = cx + 1 == cw;
+			if (cy == 0 || (!last && rnd.below(2))) {
+				if (!last) {
+					row[2 * cx + 2] = ' ';
+				}
+				continue;
 			}
+			int k = run_start + rnd.below(cx - run_start + 1);
+			north[2 * k + 1] = ' ';
+			run_start = cx + 1;
+		}
+	});
+}
+
+void generate_cave(Maze& map, uint64_t seed, int threads) {
+	const int fill_percent = 45;
+	const int iterations = 4;
+	int w = map.w;
+	int h = map.h;
+	map.data.resize((size_t)w * h);
+
+	auto border = [&](int x, int y) {
+		return x == 0 || y == 0 || x == w - 1 || y == h - 1;
+	};
+
+	parallel_for(h, threads, [&](size_t y) {
+		Random rnd(seed, y);
+		unsigned char *row = &map.data[y * w];
+		for (int x = 0 ; x < w ; ++x) {
+			row[x] = border(x, y) || (int)rnd.below(100) < fill_percent ? '*' : ' ';
 		}
-		printf("\n");
+	});
+
+	// Smoothed in place, a band of rows per task. Each band keeps the original of the row above
+	// the one it is working on, and the rows just outside the bands are saved up front, since
+	// their own bands overwrite them.
+	size_t bands = (h + band_rows - 1) / band_rows;
+	std::vector<unsigned char> edges(bands * 2 * w);
+	const std::vector<unsigned char> wall_row(w, '*');
+
+	for (int iter = 0 ; iter < iterations ; ++iter) {
+		parallel_for(bands, threads, [&](size_t b) {
+			int y0 = b * band_rows;
+			int y1 = std::min(y0 + band_rows, h);
+			const unsigned char *above = y0 > 0 ? &map.data[(size_t)(y0 - 1) * w] : wall_row.data();
+			const unsigned char *below = y1 < h ? &map.data[(size_t)y1 * w] : wall_row.data();
+			memcpy(&edges[2 * b * w], above, w);
+			memcpy(&edges[(2 * b + 1) * w], below, w);
+		});
+
+		parallel_for(bands, threads, [&](size_t b) {
+			int y0 = b * band_rows;
+			int y1 = std::min(y0 + band_rows, h);
+			std::vector<unsigned char> prev(&edges[2 * b * w], &edges[(2 * b + 1) * w]);
+			std::vector<unsigned char> cur(w);
+			for (int y = y0 ; y < y1 ; ++y) {
+				unsigned char *row = &map.data[(size_t)y * w];
+				const unsigned char *next = y + 1 < y1 ? row + w : &edges[(2 * b + 1) * w];
+				memcpy(cur.data(), row, w);
+				for (int x = 0 ; x < w ; ++x) {
+					int walls = 0;
+					for (int dx = -1 ; dx <= 1 ; ++dx) {
+						int nx = x + dx;
+						if (nx < 0 || nx >= w) {
+							walls += 3;
+							continue;
+						}
+						walls += (prev[nx] == '*') + (cur[nx] == '*') + (next[nx] == '*');
+					}
+					row[x] = border(x, y) || walls >= 5 ? '*' : ' ';
+				}
+				std::swap(prev, cur);
+			}
+		});
 	}
+}
 
-	printf("%s", std::format("Maze bounding box = {}\n", map.maze.bbox).c_str());
-	// printf(std::format("%f", "House bounding box = {}\n", map.houses.bbox).c_str());
+void generate_city(Maze& map, uint64_t seed, int threads) {
+	// City blocks of lot tiles, separated by streets two tiles wide.
+	const int street = 2;
+	const int lot = 10;
+	const int pitch = street + lot;
+	int w = map.w;
+	int h = map.h;
+	map.data.resize((size_t)w * h);
+
+	parallel_for(h, threads, [&](size_t y) {
+		unsigned char *row = &map.data[y * w];
+		int by = y / pitch;
+		int ly = y % pitch - street;
+		for (int x = 0 ; x < w ; ++x) {
+			int bx = x / pitch;
+			int lx = x % pitch - street;
+			unsigned char c = ' ';
+			if (x == 0 || (int)y == 0 || x == w - 1 || (int)y == h - 1) {
+				c = '*';
+			} else if (lx >= 0 && ly >= 0) {
+				uint64_t r = mix64(seed ^ mix64(((uint64_t)bx << 32) | (uint32_t)by));
+				bool edge = lx == 0 || ly == 0 || lx == lot - 1 || ly == lot - 1;
+				switch (r % 4) {
+					case 0:
+					case 1:
+						// A house with a pavement around it.
+						if (!edge) {
+							c = 'A' + (r >> 8) % 26;
+						}
+						break;
+					case 2:
+						// A walled yard with a gate in the middle of its south wall.
+						if (edge && !(ly == lot - 1 && (lx == lot / 2 || lx == lot / 2 - 1))) {
+							c = '*';
+						}
+						break;
+					default:
+						break;
+				}
+			}
+			row[x] = c;
+		}
+	});
+}
 
-	if (do_floor) {
-		printf("Adding floor rectangle.\n");
-		map.floor.name = "floor";
-		add_bbox_plane(map.floor, map.maze.bbox, map.maze.bbox[0].y);
+bool generate_map(const char *spec, Maze& map, int threads) {
+	char kind[16];
+	int w = 0;
+	int h = 0;
+	unsigned long long seed = 1;
+	int end = 0;
+	bool ok = sscanf(spec, "%15[a-z]:%dx%d%n", kind, &w, &h, &end) == 3;
+	if (ok && spec[end] == ':') {
+		// Only unsigned decimal seeds, which strtoull would otherwise negate or wrap.
+		const char *digits = spec + end + 1;
+		char *rest;
+		errno = 0;
+		seed = strtoull(digits, &rest, 10);
+		ok = *digits >= '0' && *digits <= '9' && *rest == '\0' && errno == 0;
+	} else {
+		ok = ok && spec[end] == '\0';
+	}
+	if (!ok || w < 3 || h < 3 || w > max_generated_size || h > max_generated_size) {
+		errno = EINVAL;
+		return false;
 	}
 
-	if (do_ceil) {
-		printf("Adding ceiling rectangle.\n");
-		map.ceiling.name = "ceiling";
-		add_bbox_plane(map.ceiling, map.maze.bbox, map.maze.bbox[1].y);
+	map.w = w;
+	map.h = h;
+	if (strcmp(kind, "maze") == 0) {
+		generate_perfect_maze(map, seed, threads);
+	} else if (strcmp(kind, "cave") == 0) {
+		generate_cave(map, seed, threads);
+	} else if (strcmp(kind, "city") == 0) {
+		generate_city(map, seed, threads);
+	} else {
+		errno = EINVAL;
+		return false;
 	}
 
-	if (do_meshopt) {
-		map.maze.optimize();
-		map.houses.optimize();
+	return true;
+}
+
+// Tile classification, the first pass over every tile. The SIMD kernels split each byte into
+// nibbles and look the low one up with pshufb in the 16-entry row of the table for its high
+// nibble. Only the rows that hold something other than the most common class are looked up;
+// bytes in the other rows keep that class.
+struct ClassifyKernel {
+	explicit ClassifyKernel(const TileClassTable& table);
+	void run(const unsigned char *src, unsigned char *dst, size_t n) const;
+
+	const TileClassTable& table;
+	unsigned char fallback;
+	int row_count;
+	unsigned char hi[16];
+	alignas(16) unsigned char rows[16][16];
+};
+
+ClassifyKernel::ClassifyKernel(const TileClassTable& t) : table(t), row_count(0) {
+	size_t count[256] = { 0 };
+	for (unsigned char c : table.cls) {
+		++count[c];
 	}
+	fallback = std::max_element(count, count + 256) - count;
 
-	if (do_write_tilemap) {
-		const char *outtilemap = "maze1.tilemap.bin";
-		FILE *f = fopen(outtilemap, "wb");
-		if (f) {
-			fwrite(&map.w, sizeof(map.w), 1, f);
-			fwrite(&map.h, sizeof(map.h), 1, f);
-			fwrite(&map.data[0], map.data.size(), 1, f);
-			fclose(f);
-			printf("Wrote tilemap data to '%s'\n", outtilemap);
+	for (int h = 0 ; h < 16 ; ++h) {
+		const unsigned char *row = &table.cls[h * 16];
+		if (std::all_of(row, row + 16, [&](unsigned char c) { return c == fallback; })) {
+			continue;
+		}
+		hi[row_count] = h;
+		memcpy(rows[row_count], row, 16);
+		++row_count;
+	}
+}
+
+void ClassifyKernel::run(const unsigned char *src, unsigned char *dst, size_t n) const {
+	size_t i = 0;
+#if defined(__AVX2__)
+	__m256i lut[16];
+	__m256i sel[16];
+	for (int k = 0 ; k < row_count ; ++k) {
+		lut[k] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)rows[k]));
+		sel[k] = _mm256_set1_epi8(hi[k]);
+	}
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	const __m256i def = _mm256_set1_epi8(fallback);
+	for ( ; i + 32 <= n ; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i lo = _mm256_and_si256(v, nibble);
+		__m256i h = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+		__m256i res = def;
+		for (int k = 0 ; k < row_count ; ++k) {
+			res = _mm256_blendv_epi8(res, _mm256_shuffle_epi8(lut[k], lo), _mm256_cmpeq_epi8(h, sel[k]));
+		}
+		_mm256_storeu_si256((__m256i*)(dst + i), res);
+	}
+#elif defined(__SSSE3__)
+	__m128i lut[16];
+	__m128i sel[16];
+	for (int k = 0 ; k < row_count ; ++k) {
+		lut[k] = _mm_load_si128((const __m128i*)rows[k]);
+		sel[k] = _mm_set1_epi8(hi[k]);
+	}
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	const __m128i def = _mm_set1_epi8(fallback);
+	for ( ; i + 16 <= n ; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i lo = _mm_and_si128(v, nibble);
+		__m128i h = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+		__m128i res = def;
+		for (int k = 0 ; k < row_count ; ++k) {
+			__m128i m = _mm_cmpeq_epi8(h, sel[k]);
+			res = _mm_or_si128(_mm_andnot_si128(m, res), _mm_and_si128(m, _mm_shuffle_epi8(lut[k], lo)));
+		}
+		_mm_storeu_si128((__m128i*)(dst + i), res);
+	}
+#endif
+	for ( ; i < n ; ++i) {
+		dst[i] = table.cls[src[i]];
+	}
+}
+
+// Classify the tiles and derive the bitplanes of each tile class, and the solid one, one 64x64
+// block at a time. Each block is classified into a scratch grid of its own, so no class grid the
+// size of the map is kept. The planes share the layout of the map.
+void build_tile_bits(Maze& map, const TileClassTable& table, int threads) {
+	static_assert(block_size == 64, "one bitplane word per block row");
+	size_t slots = map.data.size() / block_tiles;
+	for (TileBits& plane : map.planes) {
+		plane.resize(map.w, map.h, map.blocks, slots);
+	}
+	map.solid.resize(map.w, map.h, map.blocks, slots);
+	ClassifyKernel kernel(table);
+
+	// Set word 'offset' of every plane from the classes of n tiles, and note the planes with any
+	// bit set in occupied, the solid one last.
+	auto build_word = [&](const unsigned char *row, int n, size_t offset, unsigned char *occupied) {
+		uint64_t bits[tile_class_count] = { 0 };
+		int x = 0;
+#if defined(__SSE2__)
+		for ( ; x + 16 <= n ; x += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+			for (int c = 0 ; c < tile_class_count ; ++c) {
+				uint64_t m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+				bits[c] |= m << x;
+			}
+		}
+#endif
+		for ( ; x < n ; ++x) {
+			bits[row[x]] |= (uint64_t)1 << x;
+		}
+		for (int c = 0 ; c < tile_class_count ; ++c) {
+			map.planes[c].words[offset] = bits[c];
+			occupied[c] |= bits[c] != 0;
+		}
+		map.solid.words[offset] = bits[TILE_WALL] | bits[TILE_HOUSE];
+		occupied[tile_class_count] |= map.solid.words[offset] != 0;
+	};
+
+	// The shared blocks of a blocked map are built once, whole, for all the blocks that use them.
+	unsigned char shared[shared_blocks][tile_class_count + 1] = { };
+	if (map.blocked()) {
+		for (size_t slot = 0 ; slot < shared_blocks ; ++slot) {
+			unsigned char classes[block_size][block_size];
+			kernel.run(&map.data[slot * block_tiles], classes[0], block_tiles);
+			for (int r = 0 ; r < block_size ; ++r) {
+				build_word(classes[r], block_size, slot * block_size + r, shared[slot]);
+			}
+		}
+	}
+
+	parallel_for((map.h + block_size - 1) / block_size, threads, [&](size_t by) {
+		int y0 = by * block_size;
+		int y1 = std::min(y0 + block_size, map.h);
+		for (size_t i = 0 ; i < map.solid.stride ; ++i) {
+			size_t b = by * map.solid.stride + i;
+			unsigned char occupied[tile_class_count + 1] = { 0 };
+			if (map.blocked() && map.blocks[b] < shared_blocks) {
+				memcpy(occupied, shared[map.blocks[b]], sizeof(occupied));
+			} else {
+				int x0 = i * 64;
+				int n = std::min(64, map.w - x0);
+				unsigned char classes[block_size][block_size];
+				if (map.blocked()) {
+					kernel.run(&map.data[map.index(x0, y0)], classes[0], block_tiles);
+				} else {
+					for (int y = y0 ; y < y1 ; ++y) {
+						kernel.run(&map.data[map.index(x0, y)], classes[y - y0], n);
+					}
+				}
+				for (int y = y0 ; y < y1 ; ++y) {
+					build_word(classes[y - y0], n, map.solid.offset(i, y), occupied);
+				}
+			}
+			for (int c = 0 ; c < tile_class_count ; ++c) {
+				map.planes[c].occupied[b] = occupied[c];
+			}
+			map.solid.occupied[b] = occupied[tile_class_count];
+		}
+	});
+}
+
+// Buffered output that formats straight into a large reusable buffer, flushed with write(2).
+struct FileWriter {
+	explicit FileWriter(int out_fd) : fd(out_fd), buf(1 << 20) { }
+	char *reserve(size_t n);
+	void commit(char *end) { len = end - buf.data(); }
+	void puts(const char *str);
+	void write(const void *data, size_t n);
+	bool flush(void);
+
+	int fd;
+	std::vector<char> buf;
+	size_t len = 0;
+	bool ok = true;
+};
+
+// Returns a pointer to at least n free bytes; the caller hands the end of what it wrote to commit().
+char *FileWriter::reserve(size_t n) {
+	if (len + n > buf.size()) {
+		flush();
+		if (n > buf.size()) {
+			buf.resize(n);
+		}
+	}
+	return buf.data() + len;
+}
+
+void FileWriter::puts(const char *str) {
+	size_t n = strlen(str);
+	char *p = reserve(n);
+	memcpy(p, str, n);
+	commit(p + n);
+}
+
+void FileWriter::write(const void *data, size_t n) {
+	if (n == 0) {
+		return;
+	}
+	if (n <= buf.size() / 2) {
+		char *p = reserve(n);
+		memcpy(p, data, n);
+		commit(p + n);
+		return;
+	}
+
+	// Large blocks go straight to the file.
+	flush();
+	const char *p = (const char*)data;
+	while (ok && n > 0) {
+		ssize_t res = ::write(fd, p, n);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ok = false;
+			break;
+		}
+		p += res;
+		n -= res;
+	}
+}
+
+bool FileWriter::flush(void) {
+	const char *p = buf.data();
+	while (ok && len > 0) {
+		ssize_t n = ::write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ok = false;
+			break;
+		}
+		p += n;
+		len -= n;
+	}
+	len = 0;
+	return ok;
+}
+
+// Upper bounds on the length of a formatted coordinate and of an OBJ line. A 'v' line is always
+// longer than an 'f' line, whose three indices have at most 10 digits each.
+const size_t max_float_chars = 48;
+const size_t max_vertex_line = 3 + 3 * max_float_chars;
+
+// True if f is exactly the int i. Bitwise compare, which also sends -0.0 down the general path.
+bool integral_float(float f, int& i) {
+	if (f > -2147483648.0f && f < 2147483648.0f) {
+		i = (int)f;
+		float fi = (float)i;
+		return memcmp(&fi, &f, sizeof(f)) == 0;
+	}
+	return false;
+}
+
+size_t decimal_digits(unsigned int u) {
+	size_t n = 1;
+	while (u >= 10) {
+		u /= 10;
+		++n;
+	}
+	return n;
+}
+
+// Same output as printf("%f"), with a fast path for the integral coordinates we generate.
+char *format_float(char *p, float f) {
+	int i;
+	if (integral_float(f, i)) {
+		p = std::to_chars(p, p + 11, i).ptr;
+		memcpy(p, ".000000", 7);
+		return p + 7;
+	}
+	return std::to_chars(p, p + max_float_chars, (double)f, std::chars_format::fixed, 6).ptr;
+}
+
+// Length of format_float(f), formatting only off the fast path.
+size_t float_chars(float f) {
+	int i;
+	if (integral_float(f, i)) {
+		return (i < 0) + decimal_digits(i < 0 ? -(unsigned int)i : (unsigned int)i) + 7;
+	}
+	char buf[max_float_chars];
+	return format_float(buf, f) - buf;
+}
+
+char *format_vertex(char *p, const Vertex& v) {
+	*p++ = 'v';
+	*p++ = ' ';
+	p = format_float(p, v.x);
+	*p++ = ' ';
+	p = format_float(p, v.y);
+	*p++ = ' ';
+	p = format_float(p, v.z);
+	*p++ = '\n';
+	return p;
+}
+
+char *format_face(char *p, unsigned int a, unsigned int b, unsigned int c) {
+	*p++ = 'f';
+	*p++ = ' ';
+	p = std::to_chars(p, p + 10, a).ptr;
+	*p++ = ' ';
+	p = std::to_chars(p, p + 10, b).ptr;
+	*p++ = ' ';
+	p = std::to_chars(p, p + 10, c).ptr;
+	*p++ = '\n';
+	return p;
+}
+
+// A piece of an OBJ file: literal text, or a range of the 'v' or 'f' lines of a mesh.
+struct ObjPiece {
+	std::string text;
+	const Mesh *mesh = NULL;
+	bool faces = false;
+	size_t begin = 0;
+	size_t end = 0;
+	unsigned int base = 0;	// OBJ index of the mesh's first vertex.
+
+	size_t offset = 0;
+	size_t size = 0;
+};
+
+// Lines per ObjPiece, the unit of work when formatting in parallel.
+const size_t obj_piece_lines = 1 << 16;
+
+char *format_obj_line(char *p, const ObjPiece& piece, size_t i) {
+	if (piece.faces) {
+		const unsigned int *tri = &piece.mesh->indices[i * 3];
+		return format_face(p, piece.base + tri[0], piece.base + tri[1], piece.base + tri[2]);
+	}
+	return format_vertex(p, piece.mesh->vertices[i]);
+}
+
+char *format_obj_piece(char *p, const ObjPiece& piece) {
+	if (!piece.mesh) {
+		memcpy(p, piece.text.data(), piece.text.size());
+		return p + piece.text.size();
+	}
+	for (size_t i = piece.begin ; i < piece.end ; ++i) {
+		p = format_obj_line(p, piece, i);
+	}
+	return p;
+}
+
+size_t measure_obj_piece(const ObjPiece& piece) {
+	if (!piece.mesh) {
+		return piece.text.size();
+	}
+	// "f a b c\n" and "v x y z\n" are five characters around their three fields.
+	size_t size = 5 * (piece.end - piece.begin);
+	for (size_t i = piece.begin ; i < piece.end ; ++i) {
+		if (piece.faces) {
+			const unsigned int *tri = &piece.mesh->indices[i * 3];
+			size += decimal_digits(piece.base + tri[0]) + decimal_digits(piece.base + tri[1]) + decimal_digits(piece.base + tri[2]);
+		} else {
+			const Vertex& v = piece.mesh->vertices[i];
+			size += float_chars(v.x) + float_chars(v.y) + float_chars(v.z);
+		}
+	}
+	return size;
+}
+
+void add_obj_pieces(std::vector<ObjPiece>& pieces, const Mesh& mesh, size_t& total_vertex_count) {
+	if (mesh.vertices.size() == 0) {
+		return;
+	}
+
+	ObjPiece piece;
+	piece.text = "o " + mesh.name + "\n";
+	pieces.push_back(piece);
+
+	auto add_lines = [&](bool faces, size_t count) {
+		for (size_t i = 0 ; i < count ; i += obj_piece_lines) {
+			ObjPiece lines;
+			lines.mesh = &mesh;
+			lines.faces = faces;
+			lines.begin = i;
+			lines.end = std::min(i + obj_piece_lines, count);
+			lines.base = 1 + total_vertex_count;
+			pieces.push_back(lines);
+		}
+	};
+
+	add_lines(false, mesh.vertices.size());
+	piece.text = "s 0\n";
+	pieces.push_back(piece);
+	add_lines(true, mesh.indices.size() / 3);
+
+	total_vertex_count += mesh.vertices.size();
+}
+
+// With multiple threads, regular files are sized up front from the measured length of every piece
+// and mapped, so the pieces can be formatted straight into place in parallel. Otherwise, and for
+// anything that can't be mapped like a pipe, the pieces are streamed through a FileWriter.
+bool write_map_obj(const char *filename, Maze& map, int threads) {
+
+	std::vector<ObjPiece> pieces;
+	ObjPiece header;
+	header.text = "# maze2mesh -- https://github.com/eloj/maze2mesh\n";
+	pieces.push_back(header);
+
+	size_t total_vertex_count = 0;
+	for (const Mesh *mesh : map.meshes()) {
+		add_obj_pieces(pieces, *mesh, total_vertex_count);
+	}
+
+	int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		return false;
+	}
+
+	struct stat st;
+	bool ok = fstat(fd, &st) == 0;
+
+	if (ok && S_ISREG(st.st_mode) && threads > 1) {
+		parallel_for(pieces.size(), threads, [&](size_t i) {
+			pieces[i].size = measure_obj_piece(pieces[i]);
+		});
+
+		size_t size = 0;
+		for (ObjPiece& piece : pieces) {
+			piece.offset = size;
+			size += piece.size;
+		}
+
+		// Allocating the blocks and prefaulting the mapping up front is much cheaper than taking a
+		// fault on every page as the workers write to it.
+		void *mem = MAP_FAILED;
+		int err = posix_fallocate(fd, 0, size);
+		if (err == 0) {
+			mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+		} else {
+			errno = err;
+		}
+		if (mem != MAP_FAILED) {
+			parallel_for(pieces.size(), threads, [&](size_t i) {
+				format_obj_piece((char*)mem + pieces[i].offset, pieces[i]);
+			});
+			munmap(mem, size);
+		} else {
+			ok = false;
+		}
+	} else if (ok) {
+		FileWriter out(fd);
+		for (const ObjPiece& piece : pieces) {
+			if (!piece.mesh) {
+				out.puts(piece.text.c_str());
+				continue;
+			}
+			for (size_t i = piece.begin ; i < piece.end ; ++i) {
+				out.commit(format_obj_line(out.reserve(max_vertex_line), piece, i));
+			}
+		}
+		ok = out.flush();
+	}
+
+	if (close(fd) == -1) {
+		ok = false;
+	}
+	if (!ok) {
+		return false;
+	}
+
+	info("Final vertex count: %zu\n", total_vertex_count);
+
+	return true;
+}
+
+const size_t blob_align = 64;
+
+uint64_t fnv1a64(uint64_t hash, const void *data, size_t n) {
+	const unsigned char *p = (const unsigned char*)data;
+	for (size_t i = 0 ; i < n ; ++i) {
+		hash = (hash ^ p[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// The binary formats are all little-endian. Every binary writer copies its values to the file as
+// they are in memory, through BlockLayout and FileWriter, so the host must be little-endian too.
+static_assert(std::endian::native == std::endian::little, "binary outputs are written in host order");
+
+// A binary file built up from blocks of existing data, each padded with zeros so the next one
+// starts aligned to 'align', a power of two of at most blob_align.
+struct BlockLayout {
+	explicit BlockLayout(size_t alignment = blob_align) : align(alignment) { }
+
+	struct Block {
+		const void *data;
+		size_t size;
+		size_t padding;
+	};
+
+	size_t add(const void *data, size_t n);
+	uint64_t checksum(size_t first_block) const;
+	void write(FileWriter& out) const;
+	bool write(const char *filename) const;
+
+	size_t align;
+	std::vector<Block> blocks;
+	size_t size = 0;
+};
+
+const unsigned char zero_padding[blob_align] = { 0 };
+
+// Returns the file offset of the new block. The data is only read by write(), so it may be
+// filled in after its offset is known.
+size_t BlockLayout::add(const void *data, size_t n) {
+	size_t offset = size;
+	size = (offset + n + align - 1) & ~(align - 1);
+	blocks.push_back({ data, n, size - offset - n });
+	return offset;
+}
+
+uint64_t BlockLayout::checksum(size_t first_block) const {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = first_block ; i < blocks.size() ; ++i) {
+		hash = fnv1a64(hash, blocks[i].data, blocks[i].size);
+		hash = fnv1a64(hash, zero_padding, blocks[i].padding);
+	}
+	return hash;
+}
+
+void BlockLayout::write(FileWriter& out) const {
+	for (const Block& block : blocks) {
+		out.write(block.data, block.size);
+		out.write(zero_padding, block.padding);
+	}
+}
+
+bool BlockLayout::write(const char *filename) const {
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		return false;
+	}
+
+	FileWriter out(fd);
+	write(out);
+
+	bool ok = out.flush();
+	if (close(fd) == -1) {
+		ok = false;
+	}
+
+	return ok;
+}
+
+// Binary outputs store indices as uint16 when a mesh has fewer than 65536 vertices, and positions
+// as int16 x, y, z plus padding, scaled by position_scale, when every coordinate is an exact
+// multiple of it in range. Lattice coordinates qualify for maps up to 65534 tiles across.
+// Anything else falls back to float positions and uint32 indices.
+const float position_scale = 1.0f;
+
+struct QuantizedVertex {
+	int16_t x, y, z, pad;
+};
+
+struct BinaryMesh {
+	const void *vertex_data;
+	size_t vertex_stride;
+	const void *index_data;
+	size_t index_size;
+	std::vector<QuantizedVertex> qvertices;
+	std::vector<uint16_t> qindices;
+
+	bool quantized() const { return vertex_stride == sizeof(QuantizedVertex); }
+};
+
+bool quantize_positions(const VertexArray& vertices, std::vector<QuantizedVertex>& out) {
+	out.resize(vertices.size());
+	for (size_t i = 0 ; i < vertices.size() ; ++i) {
+		const float q[3] = { vertices[i].x / position_scale, vertices[i].y / position_scale, vertices[i].z / position_scale };
+		for (float c : q) {
+			if (!(c >= -32767.0f && c <= 32767.0f) || std::fabs(c - std::nearbyint(c)) > 0.0f) {
+				out.clear();
+				return false;
+			}
+		}
+		out[i] = { (int16_t)q[0], (int16_t)q[1], (int16_t)q[2], 0 };
+	}
+	return true;
+}
+
+void pack_mesh(const Mesh& mesh, bool quantize, BinaryMesh& res) {
+	res.vertex_data = mesh.vertices.data();
+	res.vertex_stride = sizeof(Vertex);
+	res.index_data = mesh.indices.data();
+	res.index_size = sizeof(unsigned int);
+
+	if (!quantize) {
+		return;
+	}
+
+	if (quantize_positions(mesh.vertices, res.qvertices)) {
+		res.vertex_data = res.qvertices.data();
+		res.vertex_stride = sizeof(QuantizedVertex);
+	}
+
+	if (mesh.vertices.size() < 65536) {
+		res.qindices.assign(mesh.indices.begin(), mesh.indices.end());
+		res.index_data = res.qindices.data();
+		res.index_size = sizeof(uint16_t);
+	}
+}
+
+// Packs every exported mesh. The results hold pointers into themselves and must not be moved.
+std::vector<BinaryMesh> pack_meshes(const std::vector<const Mesh*>& meshes, bool quantize, int threads) {
+	std::vector<BinaryMesh> res(meshes.size());
+	parallel_for(meshes.size(), threads, [&](size_t i) {
+		pack_mesh(*meshes[i], quantize, res[i]);
+	});
+	return res;
+}
+
+// Binary glTF 2.0 container around 'json' and a BIN chunk made up of the blocks in 'bin', which
+// must be aligned to four bytes.
+bool write_glb(const char *filename, std::string& json, const BlockLayout& bin) {
+	// Chunks are padded to four bytes, JSON with spaces and BIN with zeros.
+	json.append((4 - json.size() % 4) % 4, ' ');
+
+	size_t total_size = 12 + 8 + json.size();
+	if (bin.size > 0) {
+		total_size += 8 + bin.size;
+	}
+	if (total_size > std::numeric_limits<uint32_t>::max()) {
+		errno = EFBIG;
+		return false;
+	}
+
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		return false;
+	}
+
+	FileWriter out(fd);
+
+	const uint32_t header[] = { 0x46546C67, 2, (uint32_t)total_size };	// "glTF"
+	out.write(header, sizeof(header));
+
+	const uint32_t json_chunk[] = { (uint32_t)json.size(), 0x4E4F534A };	// "JSON"
+	out.write(json_chunk, sizeof(json_chunk));
+	out.write(json.data(), json.size());
+
+	if (bin.size > 0) {
+		const uint32_t bin_chunk[] = { (uint32_t)bin.size, 0x004E4942 };	// "BIN"
+		out.write(bin_chunk, sizeof(bin_chunk));
+		bin.write(out);
+	}
+
+	bool ok = out.flush();
+	if (close(fd) == -1) {
+		ok = false;
+	}
+
+	return ok;
+}
+
+// One node per mesh. The BIN chunk holds each mesh's positions followed by its indices, each
+// padded to four bytes. Quantized positions use KHR_mesh_quantization, with the node scale
+// undoing position_scale.
+bool write_map_glb(const char *filename, const Maze& map, bool quantize, int threads) {
+	std::vector<const Mesh*> meshes = map.meshes();
+	std::vector<BinaryMesh> packed = pack_meshes(meshes, quantize, threads);
+
+	std::string nodes;
+	std::string gltf_meshes;
+	std::string views;
+	std::string accessors;
+	std::string scene_nodes;
+	BlockLayout bin(4);
+	bool any_quantized = false;
+	bool any_lods = false;
+	size_t lods_end = 0;
+
+	for (size_t i = 0 ; i < meshes.size() ; ++i) {
+		const Mesh& mesh = *meshes[i];
+		const BinaryMesh& bm = packed[i];
+		size_t vertex_bytes = mesh.vertices.size() * bm.vertex_stride;
+		size_t index_bytes = mesh.indices.size() * bm.index_size;
+		size_t vertex_offset = bin.add(bm.vertex_data, vertex_bytes);
+		size_t index_offset = bin.add(bm.index_data, index_bytes);
+		const char *sep = i > 0 ? "," : "";
+
+		std::string node_scale;
+		if (bm.quantized()) {
+			node_scale = std::format(",\"scale\":[{},{},{}]", position_scale, position_scale, position_scale);
+		}
+		float s = bm.quantized() ? position_scale : 1.0f;
+
+		// LODs follow their source mesh. Only the source goes in the scene, and its node lists the
+		// LOD nodes with MSFT_lod, so the levels are not drawn on top of each other.
+		std::string node_lods;
+		if (i >= lods_end) {
+			scene_nodes += std::format("{}{}", scene_nodes.empty() ? "" : ",", i);
+			lods_end = i + 1 + mesh.lods.size();
+			if (!mesh.lods.empty()) {
+				std::string ids;
+				for (size_t j = i + 1 ; j < lods_end ; ++j) {
+					ids += std::format("{}{}", j > i + 1 ? "," : "", j);
+				}
+				node_lods = std::format(",\"extensions\":{{\"MSFT_lod\":{{\"ids\":[{}]}}}}", ids);
+				any_lods = true;
+			}
+		}
+
+		nodes += std::format("{}{{\"name\":\"{}\",\"mesh\":{}{}{}}}", sep, mesh.name, i, node_scale, node_lods);
+		gltf_meshes += std::format("{}{{\"name\":\"{}\",\"primitives\":[{{\"attributes\":{{\"POSITION\":{}}},\"indices\":{},\"mode\":4}}]}}",
+			sep, mesh.name, 2 * i, 2 * i + 1);
+		if (bm.quantized()) {
+			views += std::format("{}{{\"buffer\":0,\"byteOffset\":{},\"byteLength\":{},\"byteStride\":{},\"target\":34962}}",
+				sep, vertex_offset, vertex_bytes, bm.vertex_stride);
+		} else {
+			views += std::format("{}{{\"buffer\":0,\"byteOffset\":{},\"byteLength\":{},\"target\":34962}}", sep, vertex_offset, vertex_bytes);
+		}
+		views += std::format(",{{\"buffer\":0,\"byteOffset\":{},\"byteLength\":{},\"target\":34963}}", index_offset, index_bytes);
+		accessors += std::format("{}{{\"bufferView\":{},\"componentType\":{},\"count\":{},\"type\":\"VEC3\",\"min\":[{},{},{}],\"max\":[{},{},{}]}}",
+			sep, 2 * i, bm.quantized() ? 5122 : 5126, mesh.vertices.size(),
+			mesh.bbox[0].x / s, mesh.bbox[0].y / s, mesh.bbox[0].z / s, mesh.bbox[1].x / s, mesh.bbox[1].y / s, mesh.bbox[1].z / s);
+		accessors += std::format(",{{\"bufferView\":{},\"componentType\":{},\"count\":{},\"type\":\"SCALAR\"}}",
+			2 * i + 1, bm.index_size == sizeof(uint16_t) ? 5123 : 5125, mesh.indices.size());
+
+		any_quantized |= bm.quantized();
+	}
+
+	std::string json = std::format("{{\"asset\":{{\"version\":\"2.0\",\"generator\":\"maze2mesh\"}},\"scene\":0,\"scenes\":[{{\"nodes\":[{}]}}],", scene_nodes);
+	if (any_quantized && any_lods) {
+		json += "\"extensionsUsed\":[\"KHR_mesh_quantization\",\"MSFT_lod\"],\"extensionsRequired\":[\"KHR_mesh_quantization\"],";
+	} else if (any_quantized) {
+		json += "\"extensionsUsed\":[\"KHR_mesh_quantization\"],\"extensionsRequired\":[\"KHR_mesh_quantization\"],";
+	} else if (any_lods) {
+		json += "\"extensionsUsed\":[\"MSFT_lod\"],";
+	}
+	json += std::format("\"nodes\":[{}],\"meshes\":[{}],", nodes, gltf_meshes);
+	if (bin.size > 0) {
+		json += std::format("\"buffers\":[{{\"byteLength\":{}}}],\"bufferViews\":[{}],\"accessors\":[{}],", bin.size, views, accessors);
+	}
+	json.back() = '}';
+
+	return write_glb(filename, json, bin);
+}
+
+// Native mesh blob, meant to be mapped and used in place: a header, a table with one section
+// per mesh, then each mesh's vertex and index arrays. Offsets are from the start of the file and
+// aligned to blob_align. A section with a vertex_stride of 8 holds QuantizedVertex positions, to
+// be multiplied by position_scale, and its index_size is 2 or 4; see pack_mesh.
+struct BlobHeader {
+	uint32_t magic;			// "M2MB"
+	uint32_t version;
+	uint32_t section_count;
+	uint32_t section_size;		// sizeof(BlobSection)
+	uint64_t file_size;
+	uint64_t checksum;		// FNV-1a 64 over everything after the header.
+	float position_scale;
+	uint8_t reserved[28];
+};
+
+struct BlobSection {
+	char name[32];
+	BBox bbox;
+	uint32_t vertex_stride;
+	uint32_t index_size;
+	uint64_t vertex_offset;
+	uint64_t vertex_count;
+	uint64_t index_offset;
+	uint64_t index_count;
+};
+
+static_assert(sizeof(BlobHeader) == 64);
+static_assert(sizeof(BlobSection) == 96);
+
+const uint32_t blob_magic = 0x424D324D;
+const uint32_t blob_version = 3;
+bool write_map_blob(const char *filename, const Maze& map, bool quantize, int threads) {
+	std::vector<const Mesh*> meshes = map.meshes();
+	std::vector<BinaryMesh> packed = pack_meshes(meshes, quantize, threads);
+	std::vector<BlobSection> sections(meshes.size());
+
+	BlobHeader header;
+	memset(&header, 0, sizeof(header));
+
+	BlockLayout layout;
+	layout.add(&header, sizeof(header));
+	layout.add(sections.data(), sections.size() * sizeof(BlobSection));
+
+	for (size_t i = 0 ; i < meshes.size() ; ++i) {
+		const Mesh& mesh = *meshes[i];
+		const BinaryMesh& bm = packed[i];
+		BlobSection& sec = sections[i];
+
+		memset(&sec, 0, sizeof(sec));
+		memcpy(sec.name, mesh.name.data(), std::min(mesh.name.size(), sizeof(sec.name) - 1));
+		memcpy(sec.bbox, mesh.bbox, sizeof(BBox));
+		sec.vertex_stride = bm.vertex_stride;
+		sec.index_size = bm.index_size;
+		sec.vertex_count = mesh.vertices.size();
+		sec.vertex_offset = layout.add(bm.vertex_data, mesh.vertices.size() * bm.vertex_stride);
+		sec.index_count = mesh.indices.size();
+		sec.index_offset = layout.add(bm.index_data, mesh.indices.size() * bm.index_size);
+	}
+
+	header.magic = blob_magic;
+	header.version = blob_version;
+	header.section_count = sections.size();
+	header.section_size = sizeof(BlobSection);
+	header.file_size = layout.size;
+	header.checksum = layout.checksum(1);
+	header.position_scale = position_scale;
+
+	return layout.write(filename);
+}
+
+// Meshlet sidecar: a header, a table with one entry per exported mesh, then for each mesh its
+// meshopt_Meshlet and meshopt_Bounds arrays, and the meshlet vertex and triangle arrays built by
+// meshopt_buildMeshlets. Meshlet vertices index the mesh's vertices in the exported order.
+// Offsets and alignment follow the mesh blob.
+struct MeshletHeader {
+	uint32_t magic;			// "M2ML"
+	uint32_t version;
+	uint32_t mesh_count;
+	uint32_t mesh_size;		// sizeof(MeshletMesh)
+	uint32_t max_vertices;
+	uint32_t max_triangles;
+	uint64_t file_size;
+};
+
+struct MeshletMesh {
+	char name[32];
+	uint64_t meshlet_count;
+	uint64_t meshlet_offset;
+	uint64_t bounds_offset;
+	uint64_t vertex_count;
+	uint64_t vertex_offset;
+	uint64_t triangle_bytes;	// Three local vertex indices per triangle, each meshlet padded to four bytes.
+	uint64_t triangle_offset;
+};
+
+static_assert(sizeof(MeshletHeader) == 32);
+static_assert(sizeof(MeshletMesh) == 88);
+static_assert(sizeof(meshopt_Meshlet) == 16);
+static_assert(sizeof(meshopt_Bounds) == 48);
+
+const uint32_t meshlet_magic = 0x4C4D324D;
+const uint32_t meshlet_version = 1;
+const size_t meshlet_max_vertices = 64;
+const size_t meshlet_max_triangles = 124;
+const float meshlet_cone_weight = 0.25f;
+
+struct Meshlets {
+	std::vector<meshopt_Meshlet> meshlets;
+	std::vector<meshopt_Bounds> bounds;
+	IndexBuffer vertices;
+	std::vector<unsigned char> triangles;
+};
+
+void build_meshlets(const Mesh& mesh, Meshlets& res) {
+	size_t max_meshlets = meshopt_buildMeshletsBound(mesh.indices.size(), meshlet_max_vertices, meshlet_max_triangles);
+
+	res.meshlets.resize(max_meshlets);
+	res.vertices.resize(max_meshlets * meshlet_max_vertices);
+	res.triangles.resize(max_meshlets * meshlet_max_triangles * 3);
+
+	size_t count = meshopt_buildMeshlets(&res.meshlets[0], &res.vertices[0], &res.triangles[0], &mesh.indices[0], mesh.indices.size(),
+		&mesh.vertices[0].x, mesh.vertices.size(), sizeof(Vertex), meshlet_max_vertices, meshlet_max_triangles, meshlet_cone_weight);
+
+	res.meshlets.resize(count);
+	if (count > 0) {
+		const meshopt_Meshlet& last = res.meshlets.back();
+		res.vertices.resize(last.vertex_offset + last.vertex_count);
+		res.triangles.resize(last.triangle_offset + ((last.triangle_count * 3 + 3) & ~3));
+	}
+
+	res.bounds.resize(count);
+	for (size_t i = 0 ; i < count ; ++i) {
+		const meshopt_Meshlet& m = res.meshlets[i];
+		res.bounds[i] = meshopt_computeMeshletBounds(&res.vertices[m.vertex_offset], &res.triangles[m.triangle_offset], m.triangle_count,
+			&mesh.vertices[0].x, mesh.vertices.size(), sizeof(Vertex));
+	}
+}
+
+bool write_map_meshlets(const char *filename, const Maze& map, int threads) {
+	std::vector<const Mesh*> meshes = map.meshes();
+	std::vector<Meshlets> meshlets(meshes.size());
+	std::vector<MeshletMesh> table(meshes.size());
+
+	parallel_for(meshes.size(), threads, [&](size_t i) {
+		build_meshlets(*meshes[i], meshlets[i]);
+	});
+
+	MeshletHeader header;
+	memset(&header, 0, sizeof(header));
+
+	BlockLayout layout;
+	layout.add(&header, sizeof(header));
+	layout.add(table.data(), table.size() * sizeof(MeshletMesh));
+
+	size_t total = 0;
+	for (size_t i = 0 ; i < meshes.size() ; ++i) {
+		const Meshlets& ml = meshlets[i];
+		MeshletMesh& entry = table[i];
+
+		memset(&entry, 0, sizeof(entry));
+		memcpy(entry.name, meshes[i]->name.data(), std::min(meshes[i]->name.size(), sizeof(entry.name) - 1));
+		entry.meshlet_count = ml.meshlets.size();
+		entry.meshlet_offset = layout.add(ml.meshlets.data(), ml.meshlets.size() * sizeof(meshopt_Meshlet));
+		entry.bounds_offset = layout.add(ml.bounds.data(), ml.bounds.size() * sizeof(meshopt_Bounds));
+		entry.vertex_count = ml.vertices.size();
+		entry.vertex_offset = layout.add(ml.vertices.data(), ml.vertices.size() * sizeof(unsigned int));
+		entry.triangle_bytes = ml.triangles.size();
+		entry.triangle_offset = layout.add(ml.triangles.data(), ml.triangles.size());
+
+		total += ml.meshlets.size();
+	}
+
+	header.magic = meshlet_magic;
+	header.version = meshlet_version;
+	header.mesh_count = table.size();
+	header.mesh_size = sizeof(MeshletMesh);
+	header.max_vertices = meshlet_max_vertices;
+	header.max_triangles = meshlet_max_triangles;
+	header.file_size = layout.size;
+
+	info("Built %zu meshlets.\n", total);
+
+	return layout.write(filename);
+}
+
+// Compressed meshes: a header, a table with one entry per exported mesh, then each mesh's
+// vertex and index buffers encoded with the meshoptimizer codecs. Positions are quantized to
+// uint16 x, y, z plus padding, and decode as origin + q * scale; lattice coordinates stay exact
+// as long as the mesh spans at most 65535 units. Blocks are aligned to four bytes.
+struct PackedHeader {
+	uint32_t magic;			// "M2MZ"
+	uint32_t version;
+	uint32_t mesh_count;
+	uint32_t mesh_size;		// sizeof(PackedMesh)
+	uint64_t file_size;
+};
+
+struct PackedMesh {
+	char name[32];
+	float origin[3];
+	float scale;
+	uint32_t vertex_size;		// Size of a decoded vertex.
+	uint32_t index_size;		// Smallest index size that can hold every vertex index, 2 or 4.
+	uint64_t vertex_count;
+	uint64_t index_count;
+	uint64_t vertex_offset;
+	uint64_t vertex_bytes;
+	uint64_t index_offset;
+	uint64_t index_bytes;
+};
+
+static_assert(sizeof(PackedHeader) == 24);
+static_assert(sizeof(PackedMesh) == 104);
+
+const uint32_t packed_magic = 0x5A4D324D;
+const uint32_t packed_version = 2;
+
+struct PackedVertex {
+	uint16_t x, y, z, pad;
+};
+
+void encode_mesh(const Mesh& mesh, PackedMesh& entry, std::vector<unsigned char>& vbuf, std::vector<unsigned char>& ibuf) {
+	float extent = std::max({ mesh.bbox[1].x - mesh.bbox[0].x, mesh.bbox[1].y - mesh.bbox[0].y, mesh.bbox[1].z - mesh.bbox[0].z });
+	float scale = extent > 65535.0f ? extent / 65535.0f : 1.0f;
+
+	std::vector<PackedVertex> packed(mesh.vertices.size());
+	for (size_t i = 0 ; i < packed.size() ; ++i) {
+		const Vertex& v = mesh.vertices[i];
+		packed[i].x = (uint16_t)std::lround((v.x - mesh.bbox[0].x) / scale);
+		packed[i].y = (uint16_t)std::lround((v.y - mesh.bbox[0].y) / scale);
+		packed[i].z = (uint16_t)std::lround((v.z - mesh.bbox[0].z) / scale);
+		packed[i].pad = 0;
+	}
+
+	vbuf.resize(meshopt_encodeVertexBufferBound(packed.size(), sizeof(PackedVertex)));
+	vbuf.resize(meshopt_encodeVertexBuffer(&vbuf[0], vbuf.size(), packed.data(), packed.size(), sizeof(PackedVertex)));
+
+	ibuf.resize(meshopt_encodeIndexBufferBound(mesh.indices.size(), mesh.vertices.size()));
+	ibuf.resize(meshopt_encodeIndexBuffer(&ibuf[0], ibuf.size(), &mesh.indices[0], mesh.indices.size()));
+
+	memset(&entry, 0, sizeof(entry));
+	memcpy(entry.name, mesh.name.data(), std::min(mesh.name.size(), sizeof(entry.name) - 1));
+	entry.origin[0] = mesh.bbox[0].x;
+	entry.origin[1] = mesh.bbox[0].y;
+	entry.origin[2] = mesh.bbox[0].z;
+	entry.scale = scale;
+	entry.vertex_size = sizeof(PackedVertex);
+	entry.index_size = mesh.vertices.size() < 65536 ? sizeof(uint16_t) : sizeof(unsigned int);
+	entry.vertex_count = mesh.vertices.size();
+	entry.index_count = mesh.indices.size();
+}
+
+bool write_map_packed(const char *filename, const Maze& map, int threads) {
+	std::vector<const Mesh*> meshes = map.meshes();
+	std::vector<PackedMesh> table(meshes.size());
+	std::vector<std::vector<unsigned char>> vbufs(meshes.size());
+	std::vector<std::vector<unsigned char>> ibufs(meshes.size());
+
+	parallel_for(meshes.size(), threads, [&](size_t i) {
+		encode_mesh(*meshes[i], table[i], vbufs[i], ibufs[i]);
+	});
+
+	PackedHeader header;
+	memset(&header, 0, sizeof(header));
+
+	BlockLayout layout(4);
+	layout.add(&header, sizeof(header));
+	layout.add(table.data(), table.size() * sizeof(PackedMesh));
+
+	size_t raw_size = 0;
+	for (size_t i = 0 ; i < meshes.size() ; ++i) {
+		table[i].vertex_bytes = vbufs[i].size();
+		table[i].vertex_offset = layout.add(vbufs[i].data(), vbufs[i].size());
+		table[i].index_bytes = ibufs[i].size();
+		table[i].index_offset = layout.add(ibufs[i].data(), ibufs[i].size());
+		raw_size += meshes[i]->vertices.size() * sizeof(Vertex) + meshes[i]->indices.size() * sizeof(unsigned int);
+	}
+
+	header.magic = packed_magic;
+	header.version = packed_version;
+	header.mesh_count = table.size();
+	header.mesh_size = sizeof(PackedMesh);
+	header.file_size = layout.size;
+
+	info("Compressed %zu bytes of mesh data to %zu bytes.\n", raw_size, layout.size);
+
+	return layout.write(filename);
+}
+
+// Tilemap container: a header, an index of chunk_count + 1 file offsets, then the chunks. Each
+// chunk covers up to tilemap_chunk x tilemap_chunk tiles, clipped at the map edge, run-length
+// encoded in row-major order as pairs of a LEB128 run length and the tile byte. Chunk i spans
+// [offsets[i], offsets[i + 1]).
+struct TilemapHeader {
+	uint32_t magic;			// "M2MT"
+	uint32_t version;
+	uint32_t w;
+	uint32_t h;
+	uint32_t chunk_size;
+	uint32_t chunks_x;
+	uint32_t chunks_y;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(TilemapHeader) == 32);
+
+const uint32_t tilemap_magic = 0x544D324D;
+const uint32_t tilemap_version = 1;
+const int tilemap_chunk = 64;
+
+// Run-length encode w x h tiles, rows 'stride' apart, in row-major order.
+void rle_encode_tiles(const unsigned char *tiles, size_t stride, int w, int h, std::vector<unsigned char>& out) {
+	auto emit = [&](size_t run, unsigned char c) {
+		for ( ; run >= 0x80 ; run >>= 7) {
+			out.push_back((run & 0x7F) | 0x80);
+		}
+		out.push_back(run);
+		out.push_back(c);
+	};
+
+	size_t run = 0;
+	unsigned char cur = 0;
+	for (int y = 0 ; y < h ; ++y) {
+		const unsigned char *row = tiles + y * stride;
+		for (int x = 0 ; x < w ; ++x) {
+			if (run > 0 && row[x] == cur) {
+				++run;
+				continue;
+			}
+			if (run > 0) {
+				emit(run, cur);
+			}
+			cur = row[x];
+			run = 1;
+		}
+	}
+	if (run > 0) {
+		emit(run, cur);
+	}
+}
+
+void rle_encode_chunk(const Maze& map, int cx, int cy, std::vector<unsigned char>& out) {
+	static_assert(tilemap_chunk == block_size, "a chunk is one block, its rows a fixed stride apart");
+	int x0 = cx * tilemap_chunk;
+	int y0 = cy * tilemap_chunk;
+	int x1 = std::min(x0 + tilemap_chunk, map.w);
+	int y1 = std::min(y0 + tilemap_chunk, map.h);
+	size_t stride = map.blocked() ? block_size : map.w;
+	rle_encode_tiles(&map.data[map.index(x0, y0)], stride, x1 - x0, y1 - y0, out);
+}
+
+bool write_tilemap(const char *filename, const Maze& map, int threads) {
+	TilemapHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = tilemap_magic;
+	header.version = tilemap_version;
+	header.w = map.w;
+	header.h = map.h;
+	header.chunk_size = tilemap_chunk;
+	header.chunks_x = (map.w + tilemap_chunk - 1) / tilemap_chunk;
+	header.chunks_y = (map.h + tilemap_chunk - 1) / tilemap_chunk;
+
+	size_t num_chunks = (size_t)header.chunks_x * header.chunks_y;
+	std::vector<std::vector<unsigned char>> chunks(num_chunks);
+	std::vector<const std::vector<unsigned char>*> encoded(num_chunks);
+
+	// Chunks are blocks, so in the blocked layout the empty blocks all share the few SharedBlock
+	// slots. Those are encoded once, and every full size chunk in one reuses its bytes. Chunks
+	// clipped at the map edge hold fewer tiles and are encoded on their own.
+	std::vector<unsigned char> shared[shared_blocks];
+	if (map.blocked()) {
+		for (size_t slot = 0 ; slot < shared_blocks ; ++slot) {
+			rle_encode_tiles(&map.data[slot * block_tiles], block_size, block_size, block_size, shared[slot]);
+		}
+	}
+
+	parallel_for(num_chunks, threads, [&](size_t i) {
+		int cx = i % header.chunks_x;
+		int cy = i / header.chunks_x;
+		bool full = (cx + 1) * tilemap_chunk <= map.w && (cy + 1) * tilemap_chunk <= map.h;
+		if (map.blocked() && full && map.blocks[i] < shared_blocks) {
+			encoded[i] = &shared[map.blocks[i]];
+			return;
+		}
+		rle_encode_chunk(map, cx, cy, chunks[i]);
+		encoded[i] = &chunks[i];
+	});
+
+	std::vector<uint64_t> offsets(num_chunks + 1);
+	uint64_t offset = sizeof(header) + offsets.size() * sizeof(uint64_t);
+	for (size_t i = 0 ; i < num_chunks ; ++i) {
+		offsets[i] = offset;
+		offset += encoded[i]->size();
+	}
+	offsets[num_chunks] = offset;
+
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		return false;
+	}
+
+	FileWriter out(fd);
+	out.write(&header, sizeof(header));
+	out.write(offsets.data(), offsets.size() * sizeof(uint64_t));
+	for (const std::vector<unsigned char> *chunk : encoded) {
+		out.write(chunk->data(), chunk->size());
+	}
+
+	bool ok = out.flush();
+	if (close(fd) == -1) {
+		ok = false;
+	}
+
+	return ok;
+}
+
+void add_bbox_plane(Mesh &mesh, const BBox& bbox, float ypos) {
+	const int scale = 1;
+	int base_vrt = mesh.vertices.size();
+
+	Vertex rectverts[] = {
+		{ bbox[1].x, ypos, bbox[1].z },
+		{ bbox[1].x, ypos, bbox[0].z },
+		{ bbox[0].x, ypos, bbox[0].z },
+		{ bbox[0].x, ypos, bbox[1].z }
+	};
+
+	int rectidx[] = { 0, 1, 3, 1, 2, 3 };
+
+	for (Vertex& v : rectverts) {
+		v.x *= scale;
+		v.y *= scale;
+		v.z *= scale;
+		mesh.add_vertex(v);
+	}
+
+	for (int i : rectidx) {
+		mesh.indices.push_back(base_vrt + i);
+	}
+}
+
+// Index table over the integer lattice points at the corners of the tiles in [x0,x1) x [y0,y1),
+// two levels high. Each corner becomes a vertex the first time it is used, so the generated mesh
+// is already deduplicated.
+struct Lattice {
+	Lattice(const Maze& m, Mesh& msh, int rx0, int ry0, int rx1, int ry1) : map(m), mesh(msh), x0(rx0), y0(ry0), x1(rx1), y1(ry1),
+		stride(2 * (rx1 - rx0 + 1)), index(stride * (ry1 - ry0 + 1), ~0u) { }
+	unsigned int corner(int x, int y, int level);
+	const unsigned int *row(int y) const { return &index[(y - y0) * stride]; }
+
+	const Maze& map;
+	Mesh& mesh;
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+	size_t stride;
+	IndexBuffer index;
+};
+
+unsigned int Lattice::corner(int x, int y, int level) {
+	unsigned int& idx = index[(y - y0) * stride + (x - x0) * 2 + level];
+	if (idx == ~0u) {
+		const int scale = 1;
+		Vertex v = { (float)((x - map.w/2) * scale), (float)(level * scale), (float)((y - map.h/2 - 1) * scale) };
+		idx = mesh.add_vertex(v);
+	}
+	return idx;
+}
+
+void add_box_at(Lattice& lattice, int x, int y) {
+	// Box corners as { x, level, y } offsets on the lattice from the tile's top-left corner.
+	static const int boxcorners[][3] = {
+		{ 1, 1, 0 },
+		{ 1, 0, 0 },
+		{ 1, 1, 1 },
+		{ 1, 0, 1 },
+		{ 0, 1, 0 },
+		{ 0, 0, 0 },
+		{ 0, 1, 1 },
+		{ 0, 0, 1 }
+	};
+
+	static const int boxind[] = {
+		4, 2, 0, 2, 7, 3,
+		6, 5, 7, 1, 7, 5,
+		0, 3, 1, 4, 1, 5,
+		4, 6, 2, 2, 6, 7,
+		6, 4, 5, 1, 3, 7,
+		0, 2, 3, 4, 0, 1
+	};
+
+	for (int i : boxind) {
+		const int *c = boxcorners[i];
+		lattice.mesh.indices.push_back(lattice.corner(x + c[0], y + c[2], c[1]));
+	}
+}
+
+// Add the face of the box spanning tiles [x0,x1) x [y0,y1) that points in direction 'face'.
+void add_face(Lattice& lattice, Face face, int x0, int y0, int x1, int y1) {
+	// Face corners in counter-clockwise order, as { x1?, level, y1? } selectors per Face.
+	static const unsigned char facecorners[][4][3] = {
+		{ { 0, 1, 1 }, { 1, 1, 1 }, { 1, 1, 0 }, { 0, 1, 0 } },
+		{ { 0, 0, 0 }, { 1, 0, 0 }, { 1, 0, 1 }, { 0, 0, 1 } },
+		{ { 1, 0, 1 }, { 1, 0, 0 }, { 1, 1, 0 }, { 1, 1, 1 } },
+		{ { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 } },
+		{ { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } },
+		{ { 1, 0, 0 }, { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 } },
+	};
+
+	unsigned int quad[4];
+	for (int i = 0 ; i < 4 ; ++i) {
+		const unsigned char *c = facecorners[face][i];
+		quad[i] = lattice.corner(c[0] ? x1 : x0, c[2] ? y1 : y0, c[1]);
+	}
+	lattice.mesh.add_quad(quad);
+}
+
+bool is_solid(const Maze& map, int x, int y) {
+	if (x < 0 || y < 0 || x >= map.w || y >= map.h) {
+		return false;
+	}
+	return map.solid.test(x, y);
+}
+
+// A face is visible unless disabled, or culled because it is pressed against a solid neighbour.
+bool face_visible(const Maze& map, Face face, int x, int y, const MeshOptions& opts) {
+	switch (face) {
+		case FACE_TOP:
+			return opts.top;
+		case FACE_BOTTOM:
+			return opts.bottom;
+		case FACE_POS_X:
+			return !opts.cull || !is_solid(map, x + 1, y);
+		case FACE_NEG_X:
+			return !opts.cull || !is_solid(map, x - 1, y);
+		case FACE_POS_Z:
+			return !opts.cull || !is_solid(map, x, y + 1);
+		case FACE_NEG_Z:
+			return !opts.cull || !is_solid(map, x, y - 1);
+	}
+	return true;
+}
+
+// Greedy meshing: emit the boxes of all tiles of class 'tc' in the lattice's area, with coplanar
+// faces merged into rectangles that are maximal within that area. Top and bottom faces merge in
+// two dimensions, the unit-high side faces merge into runs along the wall.
+void add_greedy_boxes(const Maze& map, TileClass tc, const MeshOptions& opts, Lattice& lattice) {
+	const int x0 = lattice.x0;
+	const int y0 = lattice.y0;
+	const int x1 = lattice.x1;
+	const int y1 = lattice.y1;
+	const TileBits& plane = map.planes[tc];
+
+	auto is_tc = [&](int x, int y) {
+		return plane.test(x, y);
+	};
+
+	if (opts.top || opts.bottom) {
+		const int w = x1 - x0;
+		std::vector<unsigned char> done((size_t)w * (y1 - y0), 0);
+		auto is_free = [&](int x, int y) {
+			return !done[(y - y0) * w + x - x0] && is_tc(x, y);
+		};
+
+		for (int y = y0 ; y < y1 ; ++y) {
+			for (int x = x0 ; x < x1 ; ++x) {
+				uint64_t bits = plane.window(x, y);
+				if (!bits) {
+					x += 63;
+					continue;
+				}
+				x += std::countr_zero(bits);
+				if (x >= x1 || !is_free(x, y)) {
+					continue;
+				}
+
+				int rx = x + 1;
+				while (rx < x1 && is_free(rx, y)) {
+					++rx;
+				}
+
+				int ry = y + 1;
+				for ( ; ry < y1 ; ++ry) {
+					int i = x;
+					while (i < rx && is_free(i, ry)) {
+						++i;
+					}
+					if (i < rx) {
+						break;
+					}
+				}
+
+				for (int j = y ; j < ry ; ++j) {
+					memset(&done[(j - y0) * w + x - x0], 1, rx - x);
+				}
+
+				if (opts.top) {
+					add_face(lattice, FACE_TOP, x, y, rx, ry);
+				}
+				if (opts.bottom) {
+					add_face(lattice, FACE_BOTTOM, x, y, rx, ry);
+				}
+			}
+		}
+	}
+
+	auto visible = [&](Face face, int x, int y) {
+		return is_tc(x, y) && face_visible(map, face, x, y, opts);
+	};
+
+	// Runs along a row are found 64 tiles at a time.
+	auto visible_bits = [&](Face face, int x, int y) {
+		uint64_t bits = plane.window(x, y);
+		if (opts.cull) {
+			bits &= ~map.solid.window(x, face == FACE_POS_Z ? y + 1 : y - 1);
+		}
+		if (x1 - x < 64) {
+			bits &= ((uint64_t)1 << (x1 - x)) - 1;
+		}
+		return bits;
+	};
+
+	for (Face face : { FACE_NEG_Z, FACE_POS_Z }) {
+		for (int y = y0 ; y < y1 ; ++y) {
+			for (int x = x0 ; x < x1 ; ) {
+				uint64_t bits = visible_bits(face, x, y);
+				if (!bits) {
+					x += 64;
+					continue;
+				}
+				x += std::countr_zero(bits);
+				int rx = x;
+				for (int ones = 64 ; ones == 64 && rx < x1 ; rx += ones) {
+					ones = std::countr_one(visible_bits(face, rx, y));
+				}
+				add_face(lattice, face, x, y, rx, y + 1);
+				x = rx;
+			}
+		}
+	}
+
+	for (Face face : { FACE_NEG_X, FACE_POS_X }) {
+		for (int x = x0 ; x < x1 ; ++x) {
+			if (!plane.any(x, y0, x + 1, y1)) {
+				x = (x / block_size + 1) * block_size - 1;
+				continue;
+			}
+			for (int y = y0 ; y < y1 ; ) {
+				if (!visible(face, x, y)) {
+					++y;
+					continue;
+				}
+				int ry = y + 1;
+				while (ry < y1 && visible(face, x, ry)) {
+					++ry;
+				}
+				add_face(lattice, face, x, y, x + 1, ry);
+				y = ry;
+			}
+		}
+	}
+}
+
+// Emit the geometry for the tiles of class 'tc' in the area covered by the lattice.
+void add_boxes(const Maze& map, TileClass tc, const MeshOptions& opts, Lattice& lattice) {
+	if (opts.greedy) {
+		add_greedy_boxes(map, tc, opts, lattice);
+		return;
+	}
+
+	bool all_faces = !opts.cull && opts.top && opts.bottom;
+	const TileBits& plane = map.planes[tc];
+
+	// 64 tiles at a time: the tiles of class 'tc', and the tiles where each face is visible.
+	uint64_t visible[6];
+	visible[FACE_TOP] = opts.top ? ~(uint64_t)0 : 0;
+	visible[FACE_BOTTOM] = opts.bottom ? ~(uint64_t)0 : 0;
+	for (Face face : { FACE_POS_X, FACE_NEG_X, FACE_POS_Z, FACE_NEG_Z }) {
+		visible[face] = ~(uint64_t)0;
+	}
+
+	for (int y = lattice.y0 ; y < lattice.y1 ; ++y) {
+		for (int x = lattice.x0 ; x < lattice.x1 ; x += 64) {
+			uint64_t tiles = plane.window(x, y);
+			if (lattice.x1 - x < 64) {
+				tiles &= ((uint64_t)1 << (lattice.x1 - x)) - 1;
+			}
+			if (!tiles) {
+				continue;
+			}
+			if (opts.cull) {
+				visible[FACE_POS_X] = ~map.solid.window(x + 1, y);
+				visible[FACE_NEG_X] = ~map.solid.window(x - 1, y);
+				visible[FACE_POS_Z] = ~map.solid.window(x, y + 1);
+				visible[FACE_NEG_Z] = ~map.solid.window(x, y - 1);
+			}
+			for ( ; tiles ; tiles &= tiles - 1) {
+				int bit = std::countr_zero(tiles);
+				if (all_faces) {
+					add_box_at(lattice, x + bit, y);
+					continue;
+				}
+				for (Face face : { FACE_TOP, FACE_BOTTOM, FACE_POS_X, FACE_NEG_X, FACE_POS_Z, FACE_NEG_Z }) {
+					if ((visible[face] >> bit) & 1) {
+						add_face(lattice, face, x + bit, y, x + bit + 1, y + 1);
+					}
+				}
+			}
+		}
+	}
+}
+
+// Mesh the tiles of class 'tc' in bands of 'band_rows' rows, in parallel. Adjacent bands share the
+// corners on their common lattice row; these keep the index they got in the earlier band, while
+// all other vertices keep their band-local order. The merged mesh is therefore identical to what
+// a single serial pass over the bands produces, whatever the number of threads.
+void generate_mesh(const Maze& map, TileClass tc, const MeshOptions& opts, Mesh& mesh) {
+	struct Band {
+		Mesh mesh;
+		IndexBuffer top;	// Lattice indices of the first and last corner rows.
+		IndexBuffer bottom;
+		IndexBuffer remap;	// Band-local to merged vertex index.
+		size_t new_vertices;
+		size_t vertex_base;
+		size_t index_base;
+	};
+
+	const unsigned int shared = ~0u;
+	size_t num_bands = (map.h + band_rows - 1) / band_rows;
+	std::vector<Band> bands(num_bands);
+
+	parallel_for(num_bands, opts.threads, [&](size_t b) {
+		int y0 = b * band_rows;
+		int y1 = std::min(y0 + band_rows, map.h);
+		Band& band = bands[b];
+
+		// Bands without tiles of the class have no lattice, nor corners to share.
+		if (!map.planes[tc].any(0, y0, map.w, y1)) {
+			return;
+		}
+		Lattice lattice(map, band.mesh, 0, y0, map.w, y1);
+		add_boxes(map, tc, opts, lattice);
+		band.top.assign(lattice.row(y0), lattice.row(y0) + lattice.stride);
+		band.bottom.assign(lattice.row(y1), lattice.row(y1) + lattice.stride);
+	});
+
+	// Number the vertices not shared with the previous band.
+	parallel_for(num_bands, opts.threads, [&](size_t b) {
+		Band& band = bands[b];
+		band.remap.assign(band.mesh.vertices.size(), 0);
+		if (b > 0 && !band.top.empty() && !bands[b - 1].bottom.empty()) {
+			const IndexBuffer& prev = bands[b - 1].bottom;
+			for (size_t i = 0 ; i < band.top.size() ; ++i) {
+				if (band.top[i] != ~0u && prev[i] != ~0u) {
+					band.remap[band.top[i]] = shared;
+				}
+			}
+		}
+		size_t n = 0;
+		for (unsigned int& r : band.remap) {
+			if (r != shared) {
+				r = n++;
+			}
+		}
+		band.new_vertices = n;
+	});
+
+	size_t vertex_count = 0;
+	size_t index_count = 0;
+	for (Band& band : bands) {
+		band.vertex_base = vertex_count;
+		band.index_base = index_count;
+		vertex_count += band.new_vertices;
+		index_count += band.mesh.indices.size();
+	}
+
+	mesh.vertices.resize(vertex_count);
+	mesh.indices.resize(index_count);
+
+	parallel_for(num_bands, opts.threads, [&](size_t b) {
+		Band& band = bands[b];
+		for (unsigned int& r : band.remap) {
+			if (r != shared) {
+				r += band.vertex_base;
+			}
+		}
+	});
+
+	parallel_for(num_bands, opts.threads, [&](size_t b) {
+		Band& band = bands[b];
+		for (size_t i = 0 ; i < band.mesh.vertices.size() ; ++i) {
+			if (band.remap[i] != shared) {
+				mesh.vertices[band.remap[i]] = band.mesh.vertices[i];
+			}
+		}
+
+		if (b > 0 && !band.top.empty() && !bands[b - 1].bottom.empty()) {
+			const Band& prev = bands[b - 1];
+			for (size_t i = 0 ; i < band.top.size() ; ++i) {
+				if (band.top[i] != ~0u && prev.bottom[i] != ~0u) {
+					band.remap[band.top[i]] = prev.remap[prev.bottom[i]];
+				}
+			}
+		}
+
+		for (size_t i = 0 ; i < band.mesh.indices.size() ; ++i) {
+			mesh.indices[band.index_base + i] = band.remap[band.mesh.indices[i]];
+		}
+	});
+
+	for (const Band& band : bands) {
+		if (!band.mesh.vertices.empty()) {
+			mesh.extend_bbox(band.mesh.bbox[0]);
+			mesh.extend_bbox(band.mesh.bbox[1]);
+		}
+	}
+}
+
+// (Re)build the maze and houses meshes of chunk i, in map.chunks[2 * i] and map.chunks[2 * i + 1].
+void mesh_chunk(Maze& map, const MeshOptions& opts, int chunk_size, size_t i) {
+	int chunks_x = (map.w + chunk_size - 1) / chunk_size;
+	int cx = i % chunks_x;
+	int cy = i / chunks_x;
+	int x0 = cx * chunk_size;
+	int y0 = cy * chunk_size;
+	int x1 = std::min(x0 + chunk_size, map.w);
+	int y1 = std::min(y0 + chunk_size, map.h);
+
+	Mesh& maze = map.chunks[2 * i];
+	Mesh& houses = map.chunks[2 * i + 1];
+	maze = Mesh();
+	houses = Mesh();
+	maze.name = std::format("{}_{}_{}", map.maze.name, cx, cy);
+	houses.name = std::format("{}_{}_{}", map.houses.name, cx, cy);
+
+	// Only chunks with tiles of the class are meshed.
+	if (map.planes[TILE_WALL].any(x0, y0, x1, y1)) {
+		Lattice maze_lattice(map, maze, x0, y0, x1, y1);
+		add_boxes(map, TILE_WALL, opts, maze_lattice);
+	}
+	if (map.planes[TILE_HOUSE].any(x0, y0, x1, y1)) {
+		Lattice houses_lattice(map, houses, x0, y0, x1, y1);
+		add_boxes(map, TILE_HOUSE, opts, houses_lattice);
+	}
+}
+
+// Set the bounding boxes of the whole maze and houses meshes to cover all their chunks.
+void chunk_bboxes(Maze& map) {
+	for (Mesh *whole : { &map.maze, &map.houses }) {
+		whole->bbox[0] = { f_max, f_max, f_max };
+		whole->bbox[1] = { f_min, f_min, f_min };
+	}
+	for (size_t i = 0 ; i < map.chunks.size() ; ++i) {
+		const Mesh& chunk = map.chunks[i];
+		Mesh& whole = (i % 2) ? map.houses : map.maze;
+		if (!chunk.vertices.empty()) {
+			whole.extend_bbox(chunk.bbox[0]);
+			whole.extend_bbox(chunk.bbox[1]);
+		}
+	}
+}
+
+// Mesh the map as separate chunks of chunk_size x chunk_size tiles, each with its own bounding box.
+// The bounding boxes of the whole maze and houses meshes still cover all their chunks.
+void generate_chunks(Maze& map, const MeshOptions& opts, int chunk_size) {
+	int chunks_x = (map.w + chunk_size - 1) / chunk_size;
+	int chunks_y = (map.h + chunk_size - 1) / chunk_size;
+	size_t num_chunks = (size_t)chunks_x * chunks_y;
+
+	map.chunks.clear();
+	map.chunks.resize(2 * num_chunks);
+
+	parallel_for(num_chunks, opts.threads, [&](size_t i) {
+		mesh_chunk(map, opts, chunk_size, i);
+	});
+
+	chunk_bboxes(map);
+}
+
+// Instanced glTF: the unit box that add_box_at builds for the single tile of a 1x1 map, drawn by
+// one EXT_mesh_gpu_instancing node per tile class with a translation of (x - w/2, 0, y - h/2)
+// per tile. Output size and time grow with the tile count rather than the triangle count.
+bool write_map_instances(const char *filename, const Maze& map, int threads) {
+	Maze unit;
+	unit.w = 1;
+	unit.h = 1;
+	Mesh box;
+	Lattice lattice(unit, box, 0, 0, 1, 1);
+	add_box_at(lattice, 0, 0);
+
+	static const struct {
+		const char *name;
+		TileClass tc;
+	} classes[] = { { "maze", TILE_WALL }, { "houses", TILE_HOUSE } };
+	const size_t class_count = sizeof(classes) / sizeof(classes[0]);
+
+	// Translations per class and band, so the bands can be scanned in parallel and still come
+	// out in row-major order.
+	size_t bands = (map.h + band_rows - 1) / band_rows;
+	std::vector<VertexArray> offsets(class_count * bands);
+	parallel_for(bands, threads, [&](size_t b) {
+		int y0 = b * band_rows;
+		int y1 = std::min(y0 + band_rows, map.h);
+		for (size_t k = 0 ; k < class_count ; ++k) {
+			const TileBits& plane = map.planes[classes[k].tc];
+			VertexArray& out = offsets[k * bands + b];
+			if (!plane.any(0, y0, map.w, y1)) {
+				continue;
+			}
+			for (int y = y0 ; y < y1 ; ++y) {
+				for (int x = 0 ; x < map.w ; x += 64) {
+					for (uint64_t tiles = plane.window(x, y) ; tiles ; tiles &= tiles - 1) {
+						int tx = x + std::countr_zero(tiles);
+						out.push_back({ (float)(tx - map.w/2), 0.0f, (float)(y - map.h/2) });
+					}
+				}
+			}
+		}
+	});
+
+	BlockLayout bin(4);
+	size_t vertex_bytes = box.vertices.size() * sizeof(Vertex);
+	size_t index_bytes = box.indices.size() * sizeof(unsigned int);
+	bin.add(box.vertices.data(), vertex_bytes);
+	bin.add(box.indices.data(), index_bytes);
+
+	std::string nodes;
+	std::string scene_nodes;
+	std::string views = std::format("{{\"buffer\":0,\"byteOffset\":0,\"byteLength\":{},\"target\":34962}},"
+		"{{\"buffer\":0,\"byteOffset\":{},\"byteLength\":{},\"target\":34963}}", vertex_bytes, vertex_bytes, index_bytes);
+	std::string accessors = std::format("{{\"bufferView\":0,\"componentType\":5126,\"count\":{},\"type\":\"VEC3\",\"min\":[{},{},{}],\"max\":[{},{},{}]}},"
+		"{{\"bufferView\":1,\"componentType\":5125,\"count\":{},\"type\":\"SCALAR\"}}",
+		box.vertices.size(), box.bbox[0].x, box.bbox[0].y, box.bbox[0].z, box.bbox[1].x, box.bbox[1].y, box.bbox[1].z, box.indices.size());
+
+	size_t node_count = 0;
+	for (size_t k = 0 ; k < class_count ; ++k) {
+		size_t count = 0;
+		size_t offset = bin.size;
+		// Vertex is a multiple of four bytes, so the bands' blocks are contiguous. Empty bands
+		// add no block.
+		for (size_t b = 0 ; b < bands ; ++b) {
+			const VertexArray& v = offsets[k * bands + b];
+			if (v.empty()) {
+				continue;
+			}
+			bin.add(v.data(), v.size() * sizeof(Vertex));
+			count += v.size();
+		}
+		if (count == 0) {
+			continue;
+		}
+
+		size_t view = 2 + node_count;
+		const char *sep = node_count > 0 ? "," : "";
+		nodes += std::format("{}{{\"name\":\"{}\",\"mesh\":0,\"extensions\":{{\"EXT_mesh_gpu_instancing\":{{\"attributes\":{{\"TRANSLATION\":{}}}}}}}}}",
+			sep, classes[k].name, view);
+		scene_nodes += std::format("{}{}", sep, node_count);
+		views += std::format(",{{\"buffer\":0,\"byteOffset\":{},\"byteLength\":{}}}", offset, count * sizeof(Vertex));
+		accessors += std::format(",{{\"bufferView\":{},\"componentType\":5126,\"count\":{},\"type\":\"VEC3\"}}", view, count);
+		info("Instanced %zu %s tiles.\n", count, classes[k].name);
+		++node_count;
+	}
+
+	std::string json = std::format("{{\"asset\":{{\"version\":\"2.0\",\"generator\":\"maze2mesh\"}},\"scene\":0,\"scenes\":[{{\"nodes\":[{}]}}],", scene_nodes);
+	json += "\"extensionsUsed\":[\"EXT_mesh_gpu_instancing\"],\"extensionsRequired\":[\"EXT_mesh_gpu_instancing\"],";
+	json += std::format("\"nodes\":[{}],\"meshes\":[{{\"name\":\"box\",\"primitives\":[{{\"attributes\":{{\"POSITION\":0}},\"indices\":1,\"mode\":4}}]}}],", nodes);
+	json += std::format("\"buffers\":[{{\"byteLength\":{}}}],\"bufferViews\":[{}],\"accessors\":[{}]}}", bin.size, views, accessors);
+
+	return write_glb(filename, json, bin);
+}
+
+uint64_t file_size(const char *filename) {
+	struct stat st;
+	return stat(filename, &st) == 0 ? st.st_size : 0;
+}
+
+double seconds(clockid_t clock) {
+	timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Measurements of one stage of converting a map, for --report. Vertex and index counts are
+// totals over the exported meshes. CPU time and peak RSS are for the whole process, so in batch
+// mode they include the maps converted alongside.
+struct Stage {
+	const char *name;
+	double wall;			// Seconds.
+	double cpu;			// Seconds.
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	size_t vertices_before;
+	size_t indices_before;
+	size_t vertices_after;
+	size_t indices_after;
+	long peak_rss;			// KiB.
+	bool finished;
+};
+
+struct MapReport {
+	void begin(const char *name, const Maze& map);
+	void end(const Maze& map, uint64_t bytes_read = 0, uint64_t bytes_written = 0);
+
+	std::vector<Stage> stages;
+	bool ok = false;
+};
+
+void count_mesh_data(const Maze& map, size_t& vertices, size_t& indices) {
+	vertices = 0;
+	indices = 0;
+	for (const Mesh *mesh : map.meshes()) {
+		vertices += mesh->vertices.size();
+		indices += mesh->indices.size();
+	}
+}
+
+void MapReport::begin(const char *name, const Maze& map) {
+	Stage stage = {};
+	stage.name = name;
+	stage.wall = seconds(CLOCK_MONOTONIC);
+	stage.cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+	count_mesh_data(map, stage.vertices_before, stage.indices_before);
+	stages.push_back(stage);
+}
+
+void MapReport::end(const Maze& map, uint64_t bytes_read, uint64_t bytes_written) {
+	Stage& stage = stages.back();
+	stage.wall = seconds(CLOCK_MONOTONIC) - stage.wall;
+	stage.cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - stage.cpu;
+	stage.bytes_read = bytes_read;
+	stage.bytes_written = bytes_written;
+	count_mesh_data(map, stage.vertices_after, stage.indices_after);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	stage.peak_rss = usage.ru_maxrss;
+	stage.finished = true;
+}
+
+// Parse CLASS:CHARS for --tiles.
+bool parse_tile_classes(const char *arg, TileClassTable& table) {
+	static const struct {
+		const char *name;
+		TileClass tc;
+	} names[] = { { "wall", TILE_WALL }, { "house", TILE_HOUSE }, { "empty", TILE_EMPTY }, { "unknown", TILE_UNKNOWN } };
+
+	const char *colon = strchr(arg, ':');
+	if (!colon) {
+		return false;
+	}
+	for (const auto& n : names) {
+		if (strlen(n.name) == (size_t)(colon - arg) && strncmp(arg, n.name, colon - arg) == 0) {
+			return table.set(n.tc, colon + 1);
+		}
+	}
+	return false;
+}
+
+struct Job {
+	std::string input;		// A map file, or a generator spec.
+	std::string outbase;		// Empty until assigned a default.
+	bool generate;
+};
+
+// A change of the tile at (x, y) to 'tile'.
+struct TileEdit {
+	int x;
+	int y;
+	unsigned char tile;
+};
+
+// What to generate and write for each map.
+struct ConvertOptions {
+	MeshOptions mesh;
+	TileClassTable tile_classes;
+	bool do_write_tilemap = true;
+	bool do_zero_unknown_tiles = false;
+	bool do_blocked = false;
+	bool do_meshopt = false;
+	bool do_floor = true;
+	bool do_ceil = false;
+	bool do_write_glb = false;
+	bool do_write_blob = false;
+	bool do_quantize = true;
+	bool do_write_instances = false;
+	int chunk_size = 0;
+	int lod_levels = 0;
+	float lod_error = 0.01f;
+	bool do_post_transform = false;
+	bool do_write_meshlets = false;
+	bool do_write_packed = false;
+	std::vector<TileEdit> edits;	// Applied to the chunks once meshed, see edit_map().
+};
+
+// Live editing of a map converted in chunks: apply the edits to the tiles, their classes and
+// bitplanes, re-mesh and re-optimize only the chunks holding an edited tile or, when culling, one
+// of its neighbours, and rebuild the floor and ceiling for the new bounding box. The indices of the
+// re-meshed chunks, whose maze and houses meshes are map.chunks[2 * i] and map.chunks[2 * i + 1],
+// are returned in 'dirty' in ascending order. Fails with EINVAL on edits outside the map.
+bool edit_map(Maze& map, const std::vector<TileEdit>& edits, const ConvertOptions& opts, std::vector<size_t>& dirty) {
+	const int chunk_size = opts.chunk_size;
+	int chunks_x = (map.w + chunk_size - 1) / chunk_size;
+	int chunks_y = (map.h + chunk_size - 1) / chunk_size;
+	for (const TileEdit& edit : edits) {
+		if (edit.x < 0 || edit.y < 0 || edit.x >= map.w || edit.y >= map.h) {
+			errno = EINVAL;
+			return false;
+		}
+	}
+
+	std::vector<unsigned char> marked((size_t)chunks_x * chunks_y, 0);
+	auto mark = [&](int x, int y) {
+		if (x >= 0 && y >= 0 && x < map.w && y < map.h) {
+			marked[(size_t)(y / chunk_size) * chunks_x + x / chunk_size] = 1;
+		}
+	};
+
+	for (const TileEdit& edit : edits) {
+		int x = edit.x;
+		int y = edit.y;
+		TileClass tc = (TileClass)opts.tile_classes.cls[edit.tile];
+		unsigned char tile = opts.do_zero_unknown_tiles && tc == TILE_UNKNOWN ? 0 : edit.tile;
+		if (map.tile(x, y) == tile) {
+			continue;
+		}
+
+		map.own_block(x, y);
+		map.planes[map.tile_class(x, y)].set(x, y, false);
+		map.planes[tc].set(x, y, true);
+		map.solid.set(x, y, tc == TILE_WALL || tc == TILE_HOUSE);
+		map.data[map.index(x, y)] = tile;
+
+		mark(x, y);
+		if (opts.mesh.cull) {
+			mark(x - 1, y);
+			mark(x + 1, y);
+			mark(x, y - 1);
+			mark(x, y + 1);
+		}
+	}
+
+	dirty.clear();
+	for (size_t i = 0 ; i < marked.size() ; ++i) {
+		if (marked[i]) {
+			dirty.push_back(i);
+		}
+	}
+
+	// The same steps, in the same order, as a full conversion takes for each chunk.
+	parallel_for(dirty.size(), opts.mesh.threads, [&](size_t k) {
+		size_t i = dirty[k];
+		mesh_chunk(map, opts.mesh, chunk_size, i);
+		for (Mesh *chunk : { &map.chunks[2 * i], &map.chunks[2 * i + 1] }) {
+			if (opts.do_meshopt) {
+				chunk->optimize();
+			}
+			if (opts.lod_levels > 0 && !chunk->indices.empty()) {
+				chunk->build_lods(opts.lod_levels, opts.lod_error, true);
+			}
+			if (opts.do_post_transform && !chunk->vertices.empty()) {
+				chunk->optimize_post_transform();
+				for (Mesh& lod : chunk->lods) {
+					lod.optimize_post_transform();
+				}
+			}
+		}
+	});
+
+	chunk_bboxes(map);
+	auto rebuild = [&](Mesh& plane, const char *name, float ypos) {
+		plane = Mesh();
+		plane.name = name;
+		add_bbox_plane(plane, map.maze.bbox, ypos);
+		if (opts.do_post_transform) {
+			plane.optimize_post_transform();
+		}
+	};
+	if (opts.do_floor) {
+		rebuild(map.floor, "floor", map.maze.bbox[0].y);
+	}
+	if (opts.do_ceil) {
+		rebuild(map.ceiling, "ceiling", map.maze.bbox[1].y);
+	}
+	return true;
+}
+
+// Load or generate the job's map and write its outputs to its output base followed by each
+// output's extension.
+bool convert_map(const Job& job, const ConvertOptions& opts, MapReport& report) {
+	const char *filename = job.input.c_str();
+	const std::string& outbase = job.outbase;
+
+	Maze map;
+	report.begin("load", map);
+	if (job.generate) {
+		if (!generate_map(filename, map, opts.mesh.threads)) {
+			fprintf(stderr, "Error generating map '%s': %s\n", filename, error_string(errno).c_str());
+			return false;
+		}
+		report.end(map);
+	} else {
+		if (!load_maze(filename, map, opts.do_blocked, opts.mesh.threads)) {
+			fprintf(stderr, "Error loading map '%s': %s\n", filename, error_string(errno).c_str());
+			return false;
+		}
+		report.end(map, file_size(filename), 0);
+	}
+
+	info("Loaded %dx%d map '%s'\n", map.w, map.h, filename);
+
+	// Maps are loaded straight into blocks, while generators work on rows.
+	if (opts.do_blocked && job.generate) {
+		report.begin("layout", map);
+		if (!map.set_blocked(opts.mesh.threads)) {
+			fprintf(stderr, "Error laying out map '%s': %s\n", filename, error_string(errno).c_str());
+			return false;
+		}
+		report.end(map);
+	}
+
+	map.maze.name = "maze";
+	map.houses.name = "houses";
+	report.begin("classify", map);
+	build_tile_bits(map, opts.tile_classes, opts.mesh.threads);
+	if (opts.do_zero_unknown_tiles) {
+		for (size_t i = 0 ; i < map.data.size() ; ++i) {
+			if (opts.tile_classes.cls[map.data[i]] == TILE_UNKNOWN) {
+				map.data[i] = 0;
+			}
+		}
+	}
+	report.end(map);
+
+	if (verbose) {
+		std::string line;
+		for (int y = 0 ; y < map.h ; ++y) {
+			line.clear();
+			for (int x = 0 ; x < map.w ; ++x) {
+				char c = map.tile(x, y);
+				switch (map.tile_class(x, y)) {
+					case TILE_WALL:
+						c = '#';
+						break;
+					case TILE_EMPTY:
+					case TILE_HOUSE:
+						break;
+					case TILE_UNKNOWN:
+						if (opts.do_zero_unknown_tiles) {
+							c = '?';
+						}
+						break;
+				}
+				line += c;
+			}
+			info("%s\n", line.c_str());
+		}
+	}
+
+	// With edits, the tilemap is written once they are applied.
+	auto write_tilemap_stage = [&]() {
+		std::string outtilemap = outbase + ".tilemap.bin";
+		report.begin("write_tilemap", map);
+		if (!write_tilemap(outtilemap.c_str(), map, opts.mesh.threads)) {
+			fprintf(stderr, "Error writing tilemap '%s': %s\n", outtilemap.c_str(), error_string(errno).c_str());
+			return false;
+		}
+		report.end(map, 0, file_size(outtilemap.c_str()));
+		info("Wrote tilemap data to '%s'\n", outtilemap.c_str());
+		return true;
+	};
+	if (opts.do_write_tilemap && opts.edits.empty() && !write_tilemap_stage()) {
+		return false;
+	}
+
+	if (opts.do_write_instances) {
+		std::string outinstances = outbase + ".instances.glb";
+		report.begin("write_instances", map);
+		if (!write_map_instances(outinstances.c_str(), map, opts.mesh.threads)) {
+			fprintf(stderr, "Error writing instances '%s': %s\n", outinstances.c_str(), error_string(errno).c_str());
+			return false;
+		}
+		report.end(map, 0, file_size(outinstances.c_str()));
+		info("Wrote instanced glTF binary to '%s'\n", outinstances.c_str());
+		return true;
+	}
+
+	report.begin("generate", map);
+	if (opts.chunk_size > 0) {
+		generate_chunks(map, opts.mesh, opts.chunk_size);
+		size_t vertex_count = 0;
+		size_t index_count = 0;
+		for (const Mesh& chunk : map.chunks) {
+			vertex_count += chunk.vertices.size();
+			index_count += chunk.indices.size();
+		}
+		info("Generated %zu chunks: %zu vertices, %zu triangles.\n", map.chunks.size(), vertex_count, index_count / 3);
+	} else {
+		generate_mesh(map, TILE_WALL, opts.mesh, map.maze);
+		generate_mesh(map, TILE_HOUSE, opts.mesh, map.houses);
+
+		for (const Mesh *mesh : { &map.maze, &map.houses }) {
+			info("Generated %s: %zu vertices, %zu triangles.\n", mesh->name.c_str(), mesh->vertices.size(), mesh->indices.size() / 3);
+		}
+	}
+
+	report.end(map);
+
+	info("%s", std::format("Maze bounding box = {}\n", map.maze.bbox).c_str());
+	// printf(std::format("%f", "House bounding box = {}\n", map.houses.bbox).c_str());
+
+	report.begin("bbox_planes", map);
+	if (opts.do_floor) {
+		info("Adding floor rectangle.\n");
+		map.floor.name = "floor";
+		add_bbox_plane(map.floor, map.maze.bbox, map.maze.bbox[0].y);
+	}
+
+	if (opts.do_ceil) {
+		info("Adding ceiling rectangle.\n");
+		map.ceiling.name = "ceiling";
+		add_bbox_plane(map.ceiling, map.maze.bbox, map.maze.bbox[1].y);
+	}
+	report.end(map);
+
+	if (opts.do_meshopt) {
+		report.begin("optimize", map);
+		map.maze.optimize();
+		map.houses.optimize();
+		for (Mesh& chunk : map.chunks) {
+			chunk.optimize();
+		}
+		report.end(map);
+	}
+
+	if (opts.lod_levels > 0) {
+		report.begin("lod", map);
+		std::vector<Mesh*> lod_meshes;
+		for (Mesh *mesh : { &map.maze, &map.houses }) {
+			lod_meshes.push_back(mesh);
+		}
+		for (Mesh& chunk : map.chunks) {
+			lod_meshes.push_back(&chunk);
+		}
+		// The borders of chunks, which follow the whole maze and houses, stay locked.
+		parallel_for(lod_meshes.size(), opts.mesh.threads, [&](size_t i) {
+			if (!lod_meshes[i]->indices.empty()) {
+				lod_meshes[i]->build_lods(opts.lod_levels, opts.lod_error, i >= 2);
+			}
+		});
+		report.end(map);
+	}
+
+	if (opts.do_post_transform) {
+		report.begin("post_transform", map);
+		std::vector<Mesh*> meshes = map.meshes();
+		parallel_for(meshes.size(), opts.mesh.threads, [&](size_t i) {
+			meshes[i]->optimize_post_transform();
+		});
+		report.end(map);
+	}
+
+	if (!opts.edits.empty()) {
+		report.begin("edit", map);
+		std::vector<size_t> dirty;
+		if (!edit_map(map, opts.edits, opts, dirty)) {
+			fprintf(stderr, "Error editing map '%s': %s\n", filename, error_string(errno).c_str());
+			return false;
+		}
+		report.end(map);
+		info("Applied %zu edits, re-meshed %zu of %zu chunks.\n", opts.edits.size(), dirty.size(), map.chunks.size() / 2);
+		if (opts.do_write_tilemap && !write_tilemap_stage()) {
+			return false;
+		}
+	}
+
+	std::string outfile = outbase + ".obj";
+	report.begin("write_obj", map);
+	if (!write_map_obj(outfile.c_str(), map, opts.mesh.threads)) {
+		fprintf(stderr, "Error writing mesh '%s': %s\n", outfile.c_str(), error_string(errno).c_str());
+		return false;
+	}
+	report.end(map, 0, file_size(outfile.c_str()));
+	info("Wrote mesh to '%s'\n", outfile.c_str());
+
+	if (opts.do_write_glb) {
+		std::string outglb = outbase + ".glb";
+		report.begin("write_glb", map);
+		if (!write_map_glb(outglb.c_str(), map, opts.do_quantize, opts.mesh.threads)) {
+			fprintf(stderr, "Error writing glTF '%s': %s\n", outglb.c_str(), error_string(errno).c_str());
+			return false;
+		}
+		report.end(map, 0, file_size(outglb.c_str()));
+		info("Wrote glTF binary to '%s'\n", outglb.c_str());
+	}
+
+	if (opts.do_write_blob) {
+		std::string outblob = outbase + ".mesh";
+		report.begin("write_blob", map);
+		if (!write_map_blob(outblob.c_str(), map, opts.do_quantize, opts.mesh.threads)) {
+			fprintf(stderr, "Error writing mesh blob '%s': %s\n", outblob.c_str(), error_string(errno).c_str());
+			return false;
+		}
+		report.end(map, 0, file_size(outblob.c_str()));
+		info("Wrote mesh blob to '%s'\n", outblob.c_str());
+	}
+
+	if (opts.do_write_packed) {
+		std::string outpacked = outbase + ".meshz";
+		report.begin("write_packed", map);
+		if (!write_map_packed(outpacked.c_str(), map, opts.mesh.threads)) {
+			fprintf(stderr, "Error writing compressed meshes '%s': %s\n", outpacked.c_str(), error_string(errno).c_str());
+			return false;
+		}
+		report.end(map, 0, file_size(outpacked.c_str()));
+		info("Wrote compressed meshes to '%s'\n", outpacked.c_str());
+	}
+
+	if (opts.do_write_meshlets) {
+		std::string outmeshlets = outbase + ".meshlets";
+		report.begin("write_meshlets", map);
+		if (!write_map_meshlets(outmeshlets.c_str(), map, opts.mesh.threads)) {
+			fprintf(stderr, "Error writing meshlets '%s': %s\n", outmeshlets.c_str(), error_string(errno).c_str());
+			return false;
+		}
+		report.end(map, 0, file_size(outmeshlets.c_str()));
+		info("Wrote meshlets to '%s'\n", outmeshlets.c_str());
+	}
+
+	return true;
+}
+
+// Read tile edits, one "X Y C" per line, C being the new tile byte right after the single space
+// following Y, so that it may itself be a space. Blank lines and lines starting with '#' are
+// skipped.
+bool read_edits(const char *filename, std::vector<TileEdit>& edits) {
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		return false;
+	}
+
+	char *line = NULL;
+	size_t cap = 0;
+	bool ok = true;
+	while (ok && getline(&line, &cap, f) != -1) {
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+			continue;
+		}
+		char *p;
+		char *q;
+		long x = strtol(line, &p, 10);
+		long y = strtol(p, &q, 10);
+		const long max = std::numeric_limits<int>::max();
+		ok = p != line && q != p && x >= 0 && y >= 0 && x <= max && y <= max &&
+			q[0] == ' ' && q[1] != '\0' && q[1] != '\n' && strspn(q + 2, "\r\n") == strlen(q + 2);
+		if (ok) {
+			edits.push_back({ (int)x, (int)y, (unsigned char)q[1] });
+		} else {
+			errno = EINVAL;
+		}
+	}
+
+	ok = ok && !ferror(f);
+	free(line);
+	fclose(f);
+	return ok;
+}
+
+// Read a manifest of one map per line, optionally followed by whitespace and its output base.
+// Blank lines and lines starting with '#' are skipped.
+bool read_manifest(const char *filename, std::vector<Job>& jobs) {
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		return false;
+	}
+
+	char *line = NULL;
+	size_t cap = 0;
+	while (getline(&line, &cap, f) != -1) {
+		char *save = NULL;
+		const char *input = strtok_r(line, " \t\r\n", &save);
+		if (!input || input[0] == '#') {
+			continue;
+		}
+		const char *outbase = strtok_r(NULL, " \t\r\n", &save);
+		jobs.push_back({ input, outbase ? outbase : "", false });
+	}
+
+	bool ok = !ferror(f);
+	free(line);
+	fclose(f);
+	return ok;
+}
+
+std::string json_string(const std::string& str) {
+	std::string res = "\"";
+	for (unsigned char c : str) {
+		if (c == '"' || c == '\\') {
+			res += '\\';
+			res += c;
+		} else if (c < 0x20) {
+			res += std::format("\\u{:04x}", (unsigned)c);
 		} else {
-			fprintf(stderr, "Error writing tilemap '%s': %s\n", outtilemap, strerror(errno));
+			res += c;
+		}
+	}
+	return res + "\"";
+}
+
+std::string csv_string(const std::string& str) {
+	if (str.find_first_of(",\"\n") == std::string::npos) {
+		return str;
+	}
+	std::string res = "\"";
+	for (char c : str) {
+		res += c;
+		if (c == '"') {
+			res += c;
+		}
+	}
+	return res + "\"";
+}
+
+// One row per stage, for appending the reports of several runs into one table.
+std::string format_report_csv(const std::vector<Job>& jobs, const std::vector<MapReport>& reports, int threads) {
+	std::string csv = "input,output,threads,ok,stage,wall,cpu,bytes_read,bytes_written,"
+		"vertices_before,indices_before,vertices_after,indices_after,peak_rss_kib\n";
+	for (size_t i = 0 ; i < jobs.size() ; ++i) {
+		for (const Stage& st : reports[i].stages) {
+			if (!st.finished) {
+				continue;
+			}
+			csv += std::format("{},{},{},{},{},{},{},{},{},{},{},{},{},{}\n",
+				csv_string(jobs[i].input), csv_string(jobs[i].outbase), threads, reports[i].ok ? 1 : 0, st.name, st.wall, st.cpu,
+				st.bytes_read, st.bytes_written, st.vertices_before, st.indices_before, st.vertices_after, st.indices_after, st.peak_rss);
+		}
+	}
+	return csv;
+}
+
+std::string format_report_json(const std::vector<Job>& jobs, const std::vector<MapReport>& reports, int threads) {
+	std::string json = std::format("{{\"threads\":{},\"maps\":[", threads);
+	for (size_t i = 0 ; i < jobs.size() ; ++i) {
+		json += std::format("{}{{\"input\":{},\"output\":{},\"ok\":{},\"stages\":[",
+			i > 0 ? "," : "", json_string(jobs[i].input), json_string(jobs[i].outbase), reports[i].ok ? "true" : "false");
+		const char *sep = "";
+		for (const Stage& st : reports[i].stages) {
+			if (!st.finished) {
+				continue;
+			}
+			json += std::format("{}{{\"name\":\"{}\",\"wall\":{},\"cpu\":{},\"bytes_read\":{},\"bytes_written\":{},"
+				"\"vertices_before\":{},\"indices_before\":{},\"vertices_after\":{},\"indices_after\":{},\"peak_rss_kib\":{}}}",
+				sep, st.name, st.wall, st.cpu, st.bytes_read, st.bytes_written,
+				st.vertices_before, st.indices_before, st.vertices_after, st.indices_after, st.peak_rss);
+			sep = ",";
+		}
+		json += "]}";
+	}
+	return json + "]}\n";
+}
+
+// The stages of every map as JSON, or as CSV if the file name ends in ".csv", with times in
+// seconds. A stage that failed is left out.
+bool write_report(const char *filename, const std::vector<Job>& jobs, const std::vector<MapReport>& reports, int threads) {
+	size_t len = strlen(filename);
+	bool csv = len >= 4 && strcmp(filename + len - 4, ".csv") == 0;
+	std::string text = csv ? format_report_csv(jobs, reports, threads) : format_report_json(jobs, reports, threads);
+
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		return false;
+	}
+
+	FileWriter out(fd);
+	out.write(text.data(), text.size());
+
+	bool ok = out.flush();
+	if (close(fd) == -1) {
+		ok = false;
+	}
+
+	return ok;
+}
+
+// The input's file name without its extension, in directory 'dir'.
+std::string default_outbase(const std::string& input, const char *dir) {
+	size_t slash = input.rfind('/');
+	std::string stem = input.substr(slash == std::string::npos ? 0 : slash + 1);
+	size_t dot = stem.rfind('.');
+	if (dot != std::string::npos && dot > 0) {
+		stem.resize(dot);
+	}
+	return std::string(dir) + "/" + stem;
+}
+
+void usage(const char *prog) {
+	printf("Usage: %s [OPTION]... [MAPFILE]...\n\n", prog);
+	printf("  -g, --greedy    merge coplanar wall faces into rectangles, up to 64 rows high\n");
+	printf("  -c, --cull      drop wall faces pressed against a neighbouring wall\n");
+	printf("      --no-top    drop the top faces of walls\n");
+	printf("      --no-bottom drop the bottom faces of walls\n");
+	printf("      --meshopt   run the meshoptimizer vertex remap on the generated meshes\n");
+	printf("      --glb       also write the meshes as binary glTF to maze1.glb\n");
+	printf("      --blob      also write the meshes as a native mesh blob to maze1.mesh\n");
+	printf("      --packed    also write meshopt-compressed meshes to maze1.meshz\n");
+	printf("      --instances write one box and per-tile instances to maze1.instances.glb, and no meshes\n");
+	printf("      --no-quantize  keep float positions and 32-bit indices in the glTF and blob output\n");
+	printf("      --meshlets  also write meshlets and their bounds to maze1.meshlets\n");
+	printf("      --blocked   store the map in 64x64 blocks rather than rows, for very large maps\n");
+	printf("      --tiles=CLASS:CHARS  classify the tile bytes in CHARS, where a-z is a range, as wall,\n");
+	printf("                  house, empty or unknown\n");
+	printf("      --chunk=N   split the maze and houses into separate meshes of NxN tiles\n");
+	printf("      --edits=FILE  with --chunk, apply the tile edits in FILE, one 'X Y C' per line, after\n");
+	printf("                  meshing and re-mesh only the chunks they change\n");
+	printf("      --lod=N     add up to N simplified levels of detail per maze and houses mesh\n");
+	printf("      --lod-error=E  relative error bound of the first LOD, doubling per level (default %.2f)\n", 0.01);
+	printf("      --post-transform  optimize the meshes for vertex cache, overdraw and vertex fetch\n");
+	printf("  -o, --output=BASE  write the outputs of a single map to BASE.obj and so on (default maze1)\n");
+	printf("      --output-dir=DIR  write each map's outputs to DIR, named after the map\n");
+	printf("      --manifest=FILE  also convert the maps listed in FILE, one per line, each optionally\n");
+	printf("                  followed by its output base\n");
+	printf("      --generate=KIND:WxH[:SEED]  also convert a synthetic map, KIND being maze, cave or city\n");
+	printf("      --report=FILE  write the time, I/O, mesh sizes and memory use of every stage as JSON,\n");
+	printf("                  or CSV if FILE ends in .csv\n");
+	printf("  -q, --quiet     only print errors\n");
+	printf("  -j, --threads=N number of threads to generate meshes with\n");
+	printf("  -h, --help      show this help\n");
+}
+
+int main(int argc, char *argv[]) {
+	ConvertOptions opts;
+	opts.mesh.threads = std::max(1u, std::thread::hardware_concurrency());
+	const char *output = NULL;
+	const char *output_dir = NULL;
+	const char *manifest = NULL;
+	const char *edits = NULL;
+	const char *report = NULL;
+	bool quiet = false;
+	std::vector<Job> generated;
+
+	enum {
+		OPT_NO_TOP = 256,
+		OPT_NO_BOTTOM,
+		OPT_MESHOPT,
+		OPT_GLB,
+		OPT_BLOB,
+		OPT_CHUNK,
+		OPT_LOD,
+		OPT_LOD_ERROR,
+		OPT_POST_TRANSFORM,
+		OPT_MESHLETS,
+		OPT_PACKED,
+		OPT_NO_QUANTIZE,
+		OPT_INSTANCES,
+		OPT_OUTPUT_DIR,
+		OPT_MANIFEST,
+		OPT_REPORT,
+		OPT_GENERATE,
+		OPT_TILES,
+		OPT_BLOCKED,
+		OPT_EDITS,
+	};
+
+	static const struct option long_options[] = {
+		{ "greedy", no_argument, NULL, 'g' },
+		{ "cull", no_argument, NULL, 'c' },
+		{ "no-top", no_argument, NULL, OPT_NO_TOP },
+		{ "no-bottom", no_argument, NULL, OPT_NO_BOTTOM },
+		{ "meshopt", no_argument, NULL, OPT_MESHOPT },
+		{ "glb", no_argument, NULL, OPT_GLB },
+		{ "blob", no_argument, NULL, OPT_BLOB },
+		{ "chunk", required_argument, NULL, OPT_CHUNK },
+		{ "lod", required_argument, NULL, OPT_LOD },
+		{ "lod-error", required_argument, NULL, OPT_LOD_ERROR },
+		{ "post-transform", no_argument, NULL, OPT_POST_TRANSFORM },
+		{ "meshlets", no_argument, NULL, OPT_MESHLETS },
+		{ "packed", no_argument, NULL, OPT_PACKED },
+		{ "no-quantize", no_argument, NULL, OPT_NO_QUANTIZE },
+		{ "instances", no_argument, NULL, OPT_INSTANCES },
+		{ "output", required_argument, NULL, 'o' },
+		{ "output-dir", required_argument, NULL, OPT_OUTPUT_DIR },
+		{ "manifest", required_argument, NULL, OPT_MANIFEST },
+		{ "report", required_argument, NULL, OPT_REPORT },
+		{ "generate", required_argument, NULL, OPT_GENERATE },
+		{ "tiles", required_argument, NULL, OPT_TILES },
+		{ "blocked", no_argument, NULL, OPT_BLOCKED },
+		{ "edits", required_argument, NULL, OPT_EDITS },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "threads", required_argument, NULL, 'j' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "gco:qj:h", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'g':
+				opts.mesh.greedy = true;
+				break;
+			case 'c':
+				opts.mesh.cull = true;
+				break;
+			case OPT_NO_TOP:
+				opts.mesh.top = false;
+				break;
+			case OPT_NO_BOTTOM:
+				opts.mesh.bottom = false;
+				break;
+			case OPT_MESHOPT:
+				opts.do_meshopt = true;
+				break;
+			case OPT_GLB:
+				opts.do_write_glb = true;
+				break;
+			case OPT_BLOB:
+				opts.do_write_blob = true;
+				break;
+			case OPT_CHUNK:
+				opts.chunk_size = atoi(optarg);
+				if (opts.chunk_size < 1) {
+					fprintf(stderr, "Invalid chunk size '%s'\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_LOD:
+				opts.lod_levels = atoi(optarg);
+				if (opts.lod_levels < 0) {
+					fprintf(stderr, "Invalid LOD count '%s'\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_LOD_ERROR:
+				opts.lod_error = atof(optarg);
+				if (!(opts.lod_error > 0)) {
+					fprintf(stderr, "Invalid LOD error '%s'\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_POST_TRANSFORM:
+				opts.do_post_transform = true;
+				break;
+			case OPT_MESHLETS:
+				opts.do_write_meshlets = true;
+				break;
+			case OPT_PACKED:
+				opts.do_write_packed = true;
+				break;
+			case OPT_NO_QUANTIZE:
+				opts.do_quantize = false;
+				break;
+			case OPT_INSTANCES:
+				opts.do_write_instances = true;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case OPT_OUTPUT_DIR:
+				output_dir = optarg;
+				break;
+			case OPT_MANIFEST:
+				manifest = optarg;
+				break;
+			case OPT_REPORT:
+				report = optarg;
+				break;
+			case OPT_GENERATE:
+				generated.push_back({ optarg, "", true });
+				break;
+			case OPT_TILES:
+				if (!parse_tile_classes(optarg, opts.tile_classes)) {
+					fprintf(stderr, "Invalid tile classes '%s'\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_BLOCKED:
+				opts.do_blocked = true;
+				break;
+			case OPT_EDITS:
+				edits = optarg;
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			case 'j':
+				opts.mesh.threads = atoi(optarg);
+				if (opts.mesh.threads < 1) {
+					fprintf(stderr, "Invalid thread count '%s'\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'h':
+				usage(argv[0]);
+				return EXIT_SUCCESS;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (edits) {
+		if (opts.chunk_size < 1 || opts.do_write_instances) {
+			fprintf(stderr, "--edits needs --chunk, and no --instances\n");
+			return EXIT_FAILURE;
+		}
+		if (!read_edits(edits, opts.edits)) {
+			fprintf(stderr, "Error reading edits '%s': %s\n", edits, error_string(errno).c_str());
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<Job> jobs = std::move(generated);
+	if (manifest && !read_manifest(manifest, jobs)) {
+		fprintf(stderr, "Error reading manifest '%s': %s\n", manifest, error_string(errno).c_str());
+		return EXIT_FAILURE;
+	}
+	for (int i = optind ; i < argc ; ++i) {
+		jobs.push_back({ argv[i], "", false });
+	}
+	if (jobs.empty()) {
+		jobs.push_back({ "data/bt1skarabrae.txt", "", false });
+	}
+
+	if (output) {
+		if (jobs.size() > 1) {
+			fprintf(stderr, "--output needs exactly one map, use --output-dir for several\n");
 			return EXIT_FAILURE;
 		}
+		jobs[0].outbase = output;
+	}
+	for (Job& job : jobs) {
+		if (job.outbase.empty()) {
+			std::string name = job.input;
+			if (job.generate) {
+				std::replace(name.begin(), name.end(), ':', '_');
+			}
+			job.outbase = jobs.size() == 1 && !output_dir ? "maze1" : default_outbase(name, output_dir ? output_dir : ".");
+		}
+	}
+
+	// Output bases are compared as normalised absolute paths, so that './a' and 'a' collide.
+	std::vector<std::pair<std::filesystem::path, const std::string*>> outbases;
+	for (const Job& job : jobs) {
+		std::error_code ec;
+		std::filesystem::path path = std::filesystem::weakly_canonical(std::filesystem::absolute(job.outbase, ec), ec);
+		outbases.push_back({ ec ? std::filesystem::path(job.outbase).lexically_normal() : path, &job.outbase });
+	}
+	std::sort(outbases.begin(), outbases.end());
+	auto dup = std::adjacent_find(outbases.begin(), outbases.end(), [](const auto& a, const auto& b) {
+		return a.first == b.first;
+	});
+	if (dup != outbases.end()) {
+		fprintf(stderr, "More than one map would be written to '%s'\n", dup->second->c_str());
+		return EXIT_FAILURE;
+	}
+
+	// Converting several maps at once would interleave their progress messages.
+	verbose = !quiet && jobs.size() == 1;
+
+	ThreadPool pool(opts.mesh.threads - 1);
+	thread_pool = &pool;
+
+	std::vector<MapReport> reports(jobs.size());
+	size_t failed = 0;
+
+	if (jobs.size() == 1) {
+		reports[0].ok = convert_map(jobs[0], opts, reports[0]);
+		failed = !reports[0].ok;
+	} else {
+		// Each map is one task. Its own parallel loops borrow whichever workers are idle.
+		std::atomic<size_t> remaining(jobs.size());
+		for (size_t i = 0 ; i < jobs.size() ; ++i) {
+			pool.submit([&, i]() {
+				const Job& job = jobs[i];
+				reports[i].ok = convert_map(job, opts, reports[i]);
+				if (reports[i].ok && !quiet) {
+					printf("Converted '%s' to '%s'\n", job.input.c_str(), job.outbase.c_str());
+				}
+				pool.finish(remaining);
+			});
+		}
+		pool.wait(remaining);
+
+		for (const MapReport& r : reports) {
+			failed += !r.ok;
+		}
+		if (!quiet) {
+			printf("Converted %zu of %zu maps.\n", jobs.size() - failed, jobs.size());
+		}
 	}
 
-	const char *outfile = "maze1.obj";
-	if (!write_map_obj(outfile, map)) {
-		fprintf(stderr, "Error writing mesh '%s': %s\n", outfile, strerror(errno));
+	if (report && !write_report(report, jobs, reports, opts.mesh.threads)) {
+		fprintf(stderr, "Error writing report '%s': %s\n", report, error_string(errno).c_str());
 		return EXIT_FAILURE;
 	}
-	printf("Wrote mesh to '%s'\n", outfile);
 
-	return EXIT_SUCCESS;
+	return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }